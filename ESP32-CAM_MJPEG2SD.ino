@@ -29,6 +29,7 @@ void OTAsetup();
 bool OTAlistener();
 bool startWifi();
 void checkConnection();                         
+extern uint8_t fbCount;
 
 const char* appVersion = "2.0";
 
@@ -96,6 +97,7 @@ void setup() {
   } 
   if (err != ESP_OK) ESP.restart();
   else Serial.println("Camera init OK");
+  fbCount = config.fb_count;
 
   sensor_t * s = esp_camera_sensor_get();
   //initial sensors are flipped vertically and colors are a bit saturated
@@ -47,31 +47,57 @@ extern char ftp_wd[];
 // additions for mjpeg2sd.cpp
 extern uint8_t fsizePtr;
 extern uint8_t minSeconds;
+extern uint16_t segmentSecs;
 extern bool debug;
 extern bool debugMotion;
 extern bool doRecording;
 extern bool isCapturing;
-extern uint8_t* SDbuffer;
 extern char* htmlBuff; 
-extern bool doPlayback;
 extern bool stopPlayback;
+extern uint8_t queueHighWater;
+extern uint16_t droppedFrames;
+extern uint16_t lateSlots;
+extern uint16_t skippedSlots;
+extern uint16_t missingSlots;
 
 extern SemaphoreHandle_t frameMutex;
 extern SemaphoreHandle_t motionMutex;
+extern SemaphoreHandle_t aviMutex;
+extern size_t sdBlockSize;
 extern bool lampVal;
 extern char* appVersion;                        
 
-void listDir(const char* fname, char* htmlBuff);
+struct playSession;
+void listDir(const char* fname, char* htmlBuff, uint32_t sid);
 uint8_t setFPSlookup(uint8_t val);
 uint8_t setFPS(uint8_t val);
-void openSDfile();
-size_t* getNextFrame();
+playSession* startPlayback(uint32_t sid);
+const uint8_t* getNextFrame(playSession* s, size_t* frameLen);
+void endPlayback(playSession* s);
 bool fetchMoveMap(uint8_t **out, size_t *out_len);
-void stopPlaying();
+void stopSession(uint32_t sid);
+void seekPlayback(uint32_t sid, uint32_t target, bool byTime);
+uint32_t playbackSecs(uint32_t sid);
+uint32_t selectTail(uint32_t sid);
+uint32_t selectFolder(uint32_t sid, const char* folder);
+void playbackSpeed(uint32_t sid, uint16_t speed);
+void playbackStep(uint32_t sid, uint8_t step);
+bool isAVI(File &fh);
+void endAVI();
+size_t aviFileSize();
+void thumbName(char* thumb, const char* mjpegName, size_t thumbLen);
+struct segment {
+  const uint8_t* data;
+  size_t len;
+}; // as in mjpeg2sd.cpp
+uint8_t readClientBuf(File &fh, byte* clientBuf, size_t buffSize, segment* segs, uint8_t maxSegs);
 void controlLamp(bool lampVal);
 float readDStemp(bool isCelsius);
 String upTime();
 uint8_t fsizeLookup(uint8_t lookup, bool old2new);
+uint8_t frameQueueDepth();
+void latencyStats(char* htmlBuff);
+void resetLatency();
 
 void deleteFolderOrFile(const char* val);
 void createUploadTask(const char* val,bool move=false);
@@ -88,6 +114,130 @@ extern bool aviOn;
 extern bool nightTime;
 extern uint8_t lightLevel;   
 extern uint8_t nightSwitch;                                  
+extern bool autoQuality;
+extern uint8_t qualityMin;
+extern uint8_t qualityMax;
+extern bool aviRecord;
+
+static uint32_t playbackId(httpd_req_t *req) {
+  // playback session id of browser tab, from sid query parameter, as returned when tab selected recording, else 0
+  char query[200] = {0,};
+  char value[12] = {0,};
+  size_t queryLen = httpd_req_get_url_query_len(req) + 1;
+  if (queryLen > sizeof(query) || httpd_req_get_url_query_str(req, query, queryLen) != ESP_OK 
+    || httpd_query_key_value(query, "sid", value, sizeof(value)) != ESP_OK) return 0;
+  return strtoul(value, NULL, 10);
+}
+
+static bool socketSend(httpd_handle_t hd, int sockfd, const char* buf, size_t bufLen) {
+  // send all of buffer on socket handed over to a task
+  for (size_t done = 0; done < bufLen; ) {
+    int len = httpd_socket_send(hd, sockfd, buf + done, bufLen - done, 0);
+    if (len <= 0) return false;
+    done += len;
+  }
+  return true;
+}
+
+// socket handed over by a handler to a task that sends on it after the handler returns. Once the server
+// closes the session, eg client gone, the socket number may be reused by another client, so is not sent on
+struct socketHandoff {
+  httpd_handle_t hd;
+  int sockfd;
+  SemaphoreHandle_t mutex; // held while sending or closing, so server cannot close session meanwhile
+  bool closed; // session closed by server
+  bool ended; // task finished with socket
+};
+
+static socketHandoff* newHandoff(httpd_req_t *req) {
+  // hand over of request's socket, or NULL if no memory
+  socketHandoff* h = (socketHandoff*)malloc(sizeof(socketHandoff));
+  if (h) *h = {req->handle, httpd_req_to_sockfd(req), xSemaphoreCreateMutex(), false, false};
+  if (h && !h->mutex) {
+    free(h);
+    h = NULL;
+  }
+  return h;
+}
+
+static void freeHandoff(socketHandoff* h) {
+  vSemaphoreDelete(h->mutex);
+  free(h);
+}
+
+static void handoffClosed(void* ctx) {
+  // session context free function, called by server when it closes session, 
+  // so task stops sending, with hand over freed by whichever of server and task is last
+  socketHandoff* h = (socketHandoff*)ctx;
+  xSemaphoreTake(h->mutex, portMAX_DELAY);
+  h->closed = true;
+  bool ended = h->ended;
+  xSemaphoreGive(h->mutex);
+  if (ended) freeHandoff(h);
+}
+
+static void watchHandoff(httpd_req_t *req, socketHandoff* h) {
+  // once task started, have server report when it closes session, as set in session on handler return
+  req->sess_ctx = h;
+  req->free_ctx = handoffClosed;
+}
+
+static bool handoffSend(socketHandoff* h, const char* buf, size_t bufLen) {
+  // send all of buffer on handed over socket, unless server has closed session
+  xSemaphoreTake(h->mutex, portMAX_DELAY);
+  bool sent = !h->closed && socketSend(h->hd, h->sockfd, buf, bufLen);
+  xSemaphoreGive(h->mutex);
+  return sent;
+}
+
+static void endHandoff(socketHandoff* h) {
+  // task finished with socket, so have server close session unless it already has
+  xSemaphoreTake(h->mutex, portMAX_DELAY);
+  bool closed = h->closed;
+  h->ended = true;
+  if (!closed) httpd_sess_trigger_close(h->hd, h->sockfd);
+  xSemaphoreGive(h->mutex);
+  if (closed) freeHandoff(h);
+}
+
+struct playStream {
+  playSession* session;
+  socketHandoff* sock;
+};
+
+static void playStreamTask(void* parameter) {
+  // stream playback session on socket handed over by stream_handler, so server is free for other browsers
+  playStream* ps = (playStream*)parameter;
+  size_t frameLen;
+  const uint8_t* frame;
+  bool sent = true;
+  while (sent && (frame = getNextFrame(ps->session, &frameLen)) != NULL) 
+    sent = handoffSend(ps->sock, (const char*)frame, frameLen);
+  endPlayback(ps->session);
+  endHandoff(ps->sock);
+  free(ps);
+  vTaskDelete(NULL);
+}
+
+static esp_err_t streamPlayback(httpd_req_t *req, playSession* session) {
+  // send response header, then hand socket to own task for playback
+  char hdr[200];
+  int hdrLen = snprintf(hdr, sizeof(hdr), "HTTP/1.1 200 OK\r\nContent-Type: %s\r\n"
+    "Access-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n", _STREAM_CONTENT_TYPE);
+  socketHandoff* sock = newHandoff(req);
+  playStream* ps = (playStream*)malloc(sizeof(playStream));
+  if (ps) *ps = {session, sock};
+  if (!ps || !sock || !handoffSend(sock, hdr, hdrLen)
+    || xTaskCreate(&playStreamTask, "playStreamTask", 4096, ps, 3, NULL) != pdPASS) {
+    Serial.println("Failed to start playback stream");
+    if (sock) freeHandoff(sock);
+    free(ps);
+    endPlayback(session);
+    return ESP_FAIL;
+  }
+  watchHandoff(req, sock); // ps may already be freed by task
+  return ESP_OK;
+}
 // end additions for mjpeg2sd.cpp
 
 static esp_err_t capture_handler(httpd_req_t *req){
@@ -121,6 +271,12 @@ static esp_err_t stream_handler(httpd_req_t *req) {
   uint8_t * jpg_buf = NULL;
   char * part_buf[64];
 
+  // additions for mjpeg2sd.cpp
+  // playback mjpeg from SD if browser selected a file or day folder, or the recording in progress
+  playSession* session = startPlayback(playbackId(req));
+  if (session) return streamPlayback(req, session);
+  // end of additions for mjpeg2sd.cpp
+
   static int64_t last_frame = 0;
   if (!last_frame) last_frame = esp_timer_get_time();
 
@@ -129,60 +285,47 @@ static esp_err_t stream_handler(httpd_req_t *req) {
 
   httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
 
-  bool startPlayback = true;
   while (true) {
     // additions for mjpeg2sd.cpp
-    if (doPlayback) {
-      // playback mjpeg from SD
-      if (startPlayback) openSDfile(); // open playback file when start streaming
-      startPlayback = false;
-      size_t* imgPtrs = getNextFrame(); 
-      size_t clusterLen = imgPtrs[0];
-      if (clusterLen) res = httpd_resp_send_chunk(req, (const char*)SDbuffer+imgPtrs[1], clusterLen);
-      else doPlayback = false;
-      if (res != ESP_OK) break;
-    } else {   
-
-      if (debugMotion) {
-        // wait for new move mapping image
-        delay(100);
-        xSemaphoreTake(motionMutex, portMAX_DELAY);
-        fetchMoveMap(&jpg_buf, &jpg_len);
-        if (!jpg_len) res = ESP_FAIL;
+    if (debugMotion) {
+      // wait for new move mapping image
+      delay(100);
+      xSemaphoreTake(motionMutex, portMAX_DELAY);
+      fetchMoveMap(&jpg_buf, &jpg_len);
+      if (!jpg_len) res = ESP_FAIL;
+    } else {
+      xSemaphoreTake(frameMutex, portMAX_DELAY); 
+      fb = esp_camera_fb_get();
+      if (!fb) {
+        Serial.println("Camera capture failed");
+        res = ESP_FAIL;
       } else {
-        xSemaphoreTake(frameMutex, portMAX_DELAY); 
-        fb = esp_camera_fb_get();
-        if (!fb) {
-          Serial.println("Camera capture failed");
-          res = ESP_FAIL;
-        } else {
-          jpg_len = fb->len;
-          jpg_buf = fb->buf;
-        }
+        jpg_len = fb->len;
+        jpg_buf = fb->buf;
       }
-      // end of additions for mjpeg2sd.cpp
-      if (res == ESP_OK) {
-        res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));    
-        size_t hlen = snprintf((char *)part_buf, 64, _STREAM_PART, jpg_len);
-        if (res == ESP_OK) res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen); 
-        if (res == ESP_OK) res = httpd_resp_send_chunk(req, (const char*)jpg_buf, jpg_len);
-      }
-      if (fb){
-        esp_camera_fb_return(fb);
-        fb = NULL;
-      } 
-      xSemaphoreGive(frameMutex);
-      xSemaphoreGive(motionMutex);
-
-      if (res != ESP_OK) break;
-      int64_t fr_end = esp_timer_get_time();
-      int64_t frame_time = fr_end - last_frame;
-      last_frame = fr_end;
-      frame_time /= 1000;
-
-      if (debug) Serial.printf("MJPG: %uB %ums (%.1ffps)\n", (uint32_t)(jpg_len),
-         (uint32_t)frame_time, 1000.0 / (uint32_t)frame_time);
     }
+    // end of additions for mjpeg2sd.cpp
+    if (res == ESP_OK) {
+      res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));    
+      size_t hlen = snprintf((char *)part_buf, 64, _STREAM_PART, jpg_len);
+      if (res == ESP_OK) res = httpd_resp_send_chunk(req, (const char *)part_buf, hlen); 
+      if (res == ESP_OK) res = httpd_resp_send_chunk(req, (const char*)jpg_buf, jpg_len);
+    }
+    if (fb){
+      esp_camera_fb_return(fb);
+      fb = NULL;
+    } 
+    xSemaphoreGive(frameMutex);
+    xSemaphoreGive(motionMutex);
+
+    if (res != ESP_OK) break;
+    int64_t fr_end = esp_timer_get_time();
+    int64_t frame_time = fr_end - last_frame;
+    last_frame = fr_end;
+    frame_time /= 1000;
+
+    if (debug) Serial.printf("MJPG: %uB %ums (%.1ffps)\n", (uint32_t)(jpg_len),
+       (uint32_t)frame_time, 1000.0 / (uint32_t)frame_time);
   }
   last_frame = 0;
   return res;
@@ -239,6 +382,7 @@ static esp_err_t cmd_handler(httpd_req_t *req){
     }
 
     int val = atoi(value);
+    uint32_t sid = playbackId(req);
     sensor_t * s = esp_camera_sensor_get();
     res = ESP_OK;
     if(!strcmp(variable, "framesize")) {
@@ -250,12 +394,13 @@ static esp_err_t cmd_handler(httpd_req_t *req){
     }
     // additions for mjpeg2sd.cpp
     else if(!strcmp(variable, "sfile")) {
-      listDir(value, htmlBuff); // get folders / files on SD
+      listDir(value, htmlBuff, sid); // get folders / files on SD, or session id for selected recording
       httpd_resp_set_type(req, "application/json");
       return httpd_resp_send(req, htmlBuff, strlen(htmlBuff));
     } 
     else if(!strcmp(variable, "fps")) setFPS(val);
     else if(!strcmp(variable, "minf")) minSeconds = val;
+    else if(!strcmp(variable, "segMins")) segmentSecs = val * 60;
     else if(!strcmp(variable, "dbg")) {
       debug = (val) ? true : false;
       Serial.setDebugOutput(debug);
@@ -266,7 +411,18 @@ static esp_err_t cmd_handler(httpd_req_t *req){
       httpd_resp_set_type(req, "application/json");
       return httpd_resp_send(req, htmlBuff, strlen(htmlBuff));
     }
-    else if(!strcmp(variable, "stopStream")) stopPlaying();
+    else if(!strcmp(variable, "stopStream")) stopSession(sid);
+    else if(!strcmp(variable, "seekFrame")) seekPlayback(sid, val, false);
+    else if(!strcmp(variable, "seekSecs")) seekPlayback(sid, val * 1000, true);
+    else if(!strcmp(variable, "tail") || !strcmp(variable, "playFolder")) {
+      // return session id for browser tab to stream selection
+      sid = strcmp(variable, "tail") ? selectFolder(sid, value) : selectTail(sid);
+      sprintf(htmlBuff, "{\"sid\":%u}", sid);
+      httpd_resp_set_type(req, "application/json");
+      return httpd_resp_send(req, htmlBuff, strlen(htmlBuff));
+    }
+    else if(!strcmp(variable, "playSpeed")) playbackSpeed(sid, val);
+    else if(!strcmp(variable, "playStep")) playbackStep(sid, val);
     else if(!strcmp(variable, "lamp")) {
       lampVal = (val) ? true : false; 
       controlLamp(lampVal);
@@ -274,6 +430,10 @@ static esp_err_t cmd_handler(httpd_req_t *req){
     else if(!strcmp(variable, "motion")) motionVal = val;
     else if(!strcmp(variable, "lswitch")) nightSwitch = val;
     else if(!strcmp(variable, "aviOn")) aviOn = val;
+    else if(!strcmp(variable, "autoQ")) autoQuality = (val) ? true : false;
+    else if(!strcmp(variable, "qmin")) qualityMin = val;
+    else if(!strcmp(variable, "qmax")) qualityMax = val;
+    else if(!strcmp(variable, "aviRecord")) aviRecord = (val) ? true : false;
     else if(!strcmp(variable, "upload")) createUploadTask(value);  
     else if(!strcmp(variable, "uploadMove")) createUploadTask(value,true);  
     else if(!strcmp(variable, "delete")) deleteFolderOrFile(value);
@@ -338,7 +498,7 @@ static esp_err_t cmd_handler(httpd_req_t *req){
 }
 
 static esp_err_t status_handler(httpd_req_t *req){
-    static char json_response[1024];
+    static char json_response[2048];
 
     sensor_t * s = esp_camera_sensor_get();
     char * p = json_response;
@@ -346,9 +506,11 @@ static esp_err_t status_handler(httpd_req_t *req){
     // additions for mjpeg2sd.cpp
     p+=sprintf(p, "\"fps\":%u,", setFPS(0)); // get FPS value
     p+=sprintf(p, "\"minf\":%u,", minSeconds);
+    p+=sprintf(p, "\"segMins\":%u,", segmentSecs / 60);
     p+=sprintf(p, "\"dbg\":%u,", debug ? 1 : 0);
     p+=sprintf(p, "\"dbgMotion\":%u,", debugMotion ? 1 : 0);
     p+=sprintf(p, "\"sfile\":%s,", "\"None\"");
+    p+=sprintf(p, "\"seekSecs\":%u,", playbackSecs(playbackId(req))); // of browser tab's playback
     p+=sprintf(p, "\"lamp\":%u,", lampVal ? 1 : 0);
     p+=sprintf(p, "\"motion\":%u,", (uint8_t)motionVal);
     p+=sprintf(p, "\"lswitch\":%u,", nightSwitch);
@@ -360,6 +522,16 @@ static esp_err_t status_handler(httpd_req_t *req){
     else p+=sprintf(p, "\"atemp\":\"n/a\",");
     p+=sprintf(p, "\"record\":%u,", doRecording ? 1 : 0);   
     p+=sprintf(p, "\"isrecord\":%s,", isCapturing ? "\"Yes\"" : "\"No\"");                                                              
+    p+=sprintf(p, "\"qdepth\":%u,", frameQueueDepth());
+    p+=sprintf(p, "\"qhigh\":%u,", queueHighWater);
+    p+=sprintf(p, "\"dropped\":%u,", droppedFrames);
+    p+=sprintf(p, "\"lateSlots\":%u,", lateSlots);
+    p+=sprintf(p, "\"skippedSlots\":%u,", skippedSlots);
+    p+=sprintf(p, "\"missingSlots\":%u,", missingSlots);
+    p+=sprintf(p, "\"autoQ\":%u,", autoQuality ? 1 : 0);
+    p+=sprintf(p, "\"qmin\":%u,", qualityMin);
+    p+=sprintf(p, "\"qmax\":%u,", qualityMax);
+    p+=sprintf(p, "\"aviRecord\":%u,", aviRecord ? 1 : 0);
     // end of additions for mjpeg2sd.cpp
     p+=sprintf(p, "\"framesize\":%u,",fsizePtr);
     p+=sprintf(p, "\"quality\":%d,", s->status.quality);
@@ -441,6 +613,182 @@ static esp_err_t jquery_handler(httpd_req_t *req){
     httpd_resp_set_type(req, "text/javascript");                              
     return httpd_resp_send(req, jquery_min_js_html, strlen(jquery_min_js_html));
 }
+static esp_err_t latency_handler(httpd_req_t *req){
+    // recording pipeline latency histograms, /latency?reset=1 to clear
+    char value[8] = {0,};
+    if (httpd_req_get_url_query_str(req, value, sizeof(value)) == ESP_OK && !strcmp(value, "reset=1")) resetLatency();
+    latencyStats(htmlBuff);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    return httpd_resp_send(req, htmlBuff, strlen(htmlBuff));
+}
+
+#define FILE_BUFF_SIZE (32 * 1024) // download chunk size, rounded up to SD read size
+#define FILE_SEGS 32 // segments of download data per buffer
+#define THUMB_MAX (32 * 1024) // largest thumbnail served
+
+struct fileStream {
+    File fh;
+    bool avi; // convert to AVI on the fly
+    size_t start, end; // byte range to send
+    socketHandoff* sock;
+};
+
+static void fileStreamTask(void* parameter) {
+    // send byte range of recording on socket handed over by file_handler, so server is free meanwhile
+    fileStream* fs = (fileStream*)parameter;
+    size_t buffSize = std::max(sdBlockSize, (size_t)FILE_BUFF_SIZE); // multiple of SD read size
+    byte* buff = (byte*)ps_malloc(buffSize);
+    bool sent = buff != NULL;
+    // AVI is converted from start, with content before range discarded, mjpeg is read from range start
+    size_t pos = fs->avi ? 0 : fs->start;
+    if (!fs->avi) fs->fh.seek(pos, SeekSet);
+    segment segs[FILE_SEGS];
+    while (sent && pos <= fs->end) {
+        // AVI conversion returns segments of buffer and generated headers, keep mjpeg SD reads aligned on SD blocks
+        uint8_t segCnt = 1;
+        if (fs->avi) segCnt = readClientBuf(fs->fh, buff, buffSize, segs, FILE_SEGS);
+        else segs[0] = {buff, fs->fh.read(buff, buffSize - pos % sdBlockSize)};
+        if (!segCnt || !segs[0].len) break;
+        for (int i = 0; sent && i < segCnt; i++) {
+            size_t len = segs[i].len;
+            size_t from = (pos < fs->start) ? std::min(fs->start - pos, len) : 0;
+            size_t to = std::min(len, fs->end + 1 - pos);
+            if (from < to) sent = handoffSend(fs->sock, (const char*)segs[i].data + from, to - from);
+            pos += len;
+        }
+    }
+    if (pos <= fs->end) Serial.printf("File download ended at %u of %u\n", pos, fs->end + 1);
+    if (fs->avi) {
+        endAVI(); // release index and files of any conversion not read to its end
+        xSemaphoreGive(aviMutex);
+    }
+    fs->fh.close();
+    free(buff);
+    endHandoff(fs->sock);
+    delete fs;
+    vTaskDelete(NULL);
+}
+
+static esp_err_t file_handler(httpd_req_t *req) {
+    // download recording, /file?name=<path>&avi=1 to convert to AVI, supporting Range so downloads can resume
+    char query[200] = {0,};
+    char value[150] = {0,};
+    char fname[150] = {0,};
+    size_t queryLen = httpd_req_get_url_query_len(req) + 1;
+    if (queryLen > sizeof(query) || httpd_req_get_url_query_str(req, query, queryLen) != ESP_OK 
+      || httpd_query_key_value(query, "name", value, sizeof(value)) != ESP_OK) {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+    urlDecode(fname, value);
+    fileStream* fs = new fileStream;
+    fs->avi = httpd_query_key_value(query, "avi", value, sizeof(value)) == ESP_OK && atoi(value);
+    fs->fh = SD_MMC.open(fname, FILE_READ);
+    if (!fs->fh || fs->fh.isDirectory()) {
+        delete fs;
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+    if (fs->avi) {
+        // conversion state is shared with ftp upload
+        if (xSemaphoreTake(aviMutex, 0) != pdTRUE) {
+            delete fs;
+            httpd_resp_set_status(req, "503 Service Unavailable");
+            return httpd_resp_send(req, "AVI conversion in use", strlen("AVI conversion in use"));
+        }
+        if (!isAVI(fs->fh)) {
+            // not convertible, so send as mjpeg
+            xSemaphoreGive(aviMutex);
+            fs->avi = false;
+        }
+    }
+    size_t total = fs->avi ? aviFileSize() : fs->fh.size();
+    // parse any byte range, as bytes=start-end, bytes=start- or bytes=-suffix
+    fs->start = 0;
+    fs->end = total - 1;
+    bool isRange = httpd_req_get_hdr_value_str(req, "Range", value, sizeof(value)) == ESP_OK && !strncmp(value, "bytes=", 6);
+    if (isRange) {
+        char* dash = strchr(value + 6, '-');
+        if (!dash) isRange = false;
+        else if (dash == value + 6) fs->start = total - std::min((size_t)strtoul(dash + 1, NULL, 10), total);
+        else {
+            fs->start = strtoul(value + 6, NULL, 10);
+            if (isdigit(dash[1])) fs->end = std::min((size_t)strtoul(dash + 1, NULL, 10), total - 1);
+        }
+    }
+    if (!total || fs->start > fs->end) {
+        if (fs->avi) {
+            endAVI();
+            xSemaphoreGive(aviMutex);
+        }
+        fs->fh.close();
+        delete fs;
+        snprintf(value, sizeof(value), "bytes */%u", total);
+        httpd_resp_set_hdr(req, "Content-Range", value);
+        httpd_resp_set_status(req, "416 Range Not Satisfiable");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    // send response header, then hand socket to own task for download
+    std::string dlName(strrchr(fname, '/') ? strrchr(fname, '/') + 1 : fname);
+    if (fs->avi) dlName = std::regex_replace(dlName, std::regex("mjpeg"), "avi");
+    char hdr[400];
+    char* p = hdr;
+    p += sprintf(p, "HTTP/1.1 %s\r\n", isRange ? "206 Partial Content" : "200 OK");
+    bool isAvi = fs->avi || dlName.find(".avi") != std::string::npos; // converted, or recorded as AVI
+    p += sprintf(p, "Content-Type: %s\r\n", isAvi ? "video/x-msvideo" : "video/x-motion-jpeg");
+    p += sprintf(p, "Content-Disposition: attachment; filename=\"%s\"\r\n", dlName.c_str());
+    p += sprintf(p, "Content-Length: %u\r\nAccept-Ranges: bytes\r\n", fs->end - fs->start + 1);
+    if (isRange) p += sprintf(p, "Content-Range: bytes %u-%u/%u\r\n", fs->start, fs->end, total);
+    p += sprintf(p, "Access-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n");
+    socketHandoff* sock = fs->sock = newHandoff(req);
+    Serial.printf("Download %s as %s, bytes %u-%u of %u\n", fname, isAvi ? "AVI" : "MJPEG", fs->start, fs->end, total);
+    if (!sock || !handoffSend(sock, hdr, p - hdr) 
+      || xTaskCreate(&fileStreamTask, "fileStreamTask", 4096, fs, 3, NULL) != pdPASS) {
+        Serial.println("Failed to start file download");
+        if (sock) freeHandoff(sock);
+        if (fs->avi) {
+            endAVI();
+            xSemaphoreGive(aviMutex);
+        }
+        fs->fh.close();
+        delete fs;
+        return ESP_FAIL;
+    }
+    watchHandoff(req, sock); // fs may already be deleted by task
+    return ESP_OK;
+}
+
+static esp_err_t thumb_handler(httpd_req_t *req) {
+    // thumbnail of recording, /thumb?name=<mjpeg path>, cached by browser as recordings do not change
+    char query[200] = {0,};
+    char value[150] = {0,};
+    char fname[150] = {0,};
+    char tname[150] = {0,};
+    size_t queryLen = httpd_req_get_url_query_len(req) + 1;
+    if (queryLen > sizeof(query) || httpd_req_get_url_query_str(req, query, queryLen) != ESP_OK 
+      || httpd_query_key_value(query, "name", value, sizeof(value)) != ESP_OK) {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+    urlDecode(fname, value);
+    thumbName(tname, fname, sizeof(tname));
+    File fh = SD_MMC.open(tname, FILE_READ);
+    size_t thumbLen = fh ? fh.size() : 0;
+    uint8_t* thumb = (thumbLen && thumbLen <= THUMB_MAX) ? (uint8_t*)malloc(thumbLen) : NULL;
+    if (thumb) thumbLen = fh.read(thumb, thumbLen);
+    if (fh) fh.close();
+    if (!thumb) {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "image/jpeg");
+    httpd_resp_set_hdr(req, "Cache-Control", "public, max-age=604800");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+    esp_err_t res = httpd_resp_send(req, (const char*)thumb, thumbLen);
+    free(thumb);
+    return res;
+}
 // end of additions for mjpeg2sd.cpp
 
 void startCameraServer(){
@@ -481,6 +829,27 @@ void startCameraServer(){
         .user_ctx  = NULL
     };
 
+    httpd_uri_t latency_uri = {
+        .uri       = "/latency",
+        .method    = HTTP_GET,
+        .handler   = latency_handler,
+        .user_ctx  = NULL
+    };
+
+    httpd_uri_t file_uri = {
+        .uri       = "/file",
+        .method    = HTTP_GET,
+        .handler   = file_handler,
+        .user_ctx  = NULL
+    };
+
+    httpd_uri_t thumb_uri = {
+        .uri       = "/thumb",
+        .method    = HTTP_GET,
+        .handler   = thumb_handler,
+        .user_ctx  = NULL
+    };
+
     httpd_uri_t stream_uri = {
         .uri       = "/stream",
         .method    = HTTP_GET,
@@ -495,6 +864,9 @@ void startCameraServer(){
         httpd_register_uri_handler(camera_httpd, &cmd_uri);
         httpd_register_uri_handler(camera_httpd, &status_uri);
         httpd_register_uri_handler(camera_httpd, &capture_uri);
+        httpd_register_uri_handler(camera_httpd, &latency_uri);
+        httpd_register_uri_handler(camera_httpd, &file_uri);
+        httpd_register_uri_handler(camera_httpd, &thumb_uri);
     }
 
     config.server_port += 1;
@@ -1,9 +1,12 @@
 
 /* 
-On the fly convert MJPEG file to AVI format when uploaded via FTP.
+On the fly convert MJPEG file to AVI format when uploaded via FTP or downloaded via /file.
 Allows recordings to replay at correct frame rate on media players.
 The file names must include the frame count to be converted, 
 so older style files will still be uploaded as MJPEGs.
+Recordings made as AVI, with aviRecord set, are built by writerTask in mjpeg2sd.cpp 
+from the same chunk layout, extended as OpenDML (AVI 2.0) so they are not limited to 1GB, 
+and are sent as is.
 
 Optionally includes a PCM audio stream recorded from an analog microphone on pin 33.
 Only records first 150 seconds per capture.
@@ -43,6 +46,23 @@ footer:
   4 byte 0000
   4 byte pcm location
   4 byte pcm size
+
+OpenDML AVI file format, as recorded with aviRecord:
+header:
+ as above, with indx super index chunk added to video strl and odml list added to hdrl
+ ODML_HEADER_LEN bytes
+per jpeg:
+ as above
+per AVI_IX_FRAMES jpegs (see mjpeg2sd.cpp), in movi list:
+ ix00 standard index chunk, of offset from base and size of each jpeg
+end of first RIFF, if followed by AVIX RIFFs:
+ idx1 index of jpegs in first RIFF, as above
+per AVIX RIFF, once RIFF nears 1GB:
+ RIFF AVIX and LIST movi headers
+ jpegs and ix00 chunks as above
+end of last RIFF:
+ idx1 index, as above, if file is a single RIFF
+ JUNK chunk holding frame index trailer of mjpeg2sd.cpp
 */
 
 #include "Arduino.h"
@@ -55,8 +75,17 @@ footer:
 static const uint8_t dcBuf[4] = {0x30, 0x30, 0x64, 0x63};   // 00dc
 static const uint8_t wbBuf[4] = {0x30, 0x31, 0x77, 0x62};   // 01wb
 static const uint8_t idx1Buf[4] = {0x69, 0x64, 0x78, 0x31}; // idx1
+static const uint8_t junkBuf[4] = {0x4A, 0x55, 0x4E, 0x4B}; // JUNK
+static const uint8_t riffBuf[4] = {0x52, 0x49, 0x46, 0x46}; // RIFF
+static const uint8_t avixBuf[4] = {0x41, 0x56, 0x49, 0x58}; // AVIX
+static const uint8_t listBuf[4] = {0x4C, 0x49, 0x53, 0x54}; // LIST
+static const uint8_t moviBuf[4] = {0x6D, 0x6F, 0x76, 0x69}; // movi
+static const uint8_t indxBuf[4] = {0x69, 0x6E, 0x64, 0x78}; // indx
+static const uint8_t ix00Buf[4] = {0x69, 0x78, 0x30, 0x30}; // ix00
+static const uint8_t odmlBuf[4] = {0x6F, 0x64, 0x6D, 0x6C}; // odml
+static const uint8_t dmlhBuf[4] = {0x64, 0x6D, 0x6C, 0x68}; // dmlh
 static const uint8_t zeroBuf[4] = {0x00, 0x00, 0x00, 0x00}; // 0000
-static uint8_t* idxBuf;
+static uint8_t* idxBuf = NULL;
 
 #define AVI_HEADER_LEN 310 // AVI header length
 static uint8_t aviHeader[AVI_HEADER_LEN] = { // AVI header template
@@ -114,22 +143,50 @@ static const size_t streamPartLen = strlen(_STREAM_PART)+6;
 #define MJPEG_HDR (LENGTH_OFFSET + REMAINDER_OFFSET)
 #define CHUNK_HDR 8 // bytes per jpeg hdr in AVI 
 #define IDX_ENTRY 16 // bytes per index entry
-#define MAX_FRAMES 20000
+#define VIDS_STRL_END 204 // end of video strl in AVI header, where OpenDML super index is added
+#define HDRL_END 298 // end of hdrl list in AVI header, where OpenDML odml list is added
+#define SUPER_ENTRIES 32 // OpenDML super index entries, as AVI_SUPER_ENTRIES in mjpeg2sd.cpp
+#define INDX_LEN (CHUNK_HDR + 24 + SUPER_ENTRIES * IDX_ENTRY) // super index chunk
+#define DMLH_LEN 248 // extended header size, as used by other writers
+#define ODML_LEN (CHUNK_HDR + 4 + CHUNK_HDR + DMLH_LEN) // odml list
+#define ODML_HEADER_LEN (AVI_HEADER_LEN + INDX_LEN + ODML_LEN) // as AVI_HDR_LEN in mjpeg2sd.cpp
+#define STD_INDEX_HDR (CHUNK_HDR + 24) // standard index chunk header
+#define STD_INDEX_ENTRY 8 // bytes per standard index entry
+#define IDX_PSRAM_MAX (64 * 1024) // pSRAM for AVI index, a longer index is spilled to SD in blocks of this size
+#define AVI_IDX_FILE "/aviIdx.tmp" // scratch file on SD for spilled index, as in mjpeg2sd.cpp
 
 static char mjpegHdrStr[MJPEG_HDR];
 static bool doAVI = false;
 static bool doAVIheader = false;
 static bool haveSoundFile = false;
-static uint16_t frameCnt = 0;
-static uint16_t framePtr = 0;
-static uint16_t idxPtr = 0;
+static uint32_t frameCnt = 0;
+static uint32_t framePtr = 0;
+static uint32_t idxPtr = 0;
 static uint32_t idxOffset;
 static uint8_t frameType;
 static uint8_t FPS;
+static uint32_t frameUs; // usecs per frame
 static size_t fileSize;
 static size_t audSize;
 static size_t indexLen;
+static size_t idxBufLen = 0; // pSRAM used for index, sized from frame count
+static size_t idxSpilled = 0; // bytes of index spilled to idxFile
+static File idxFile; // index of long recording, spilled to SD as built
 bool aviOn = true;  // set to false if do not want conversion to AVI  
+SemaphoreHandle_t aviMutex; // conversion state is shared by ftp upload and http download
+
+// readClientBuf state
+struct segment {
+  const uint8_t* data;
+  size_t len;
+}; // as in mjpeg2sd.cpp
+static size_t bufPos = 0; // next unprocessed byte of client buffer
+static size_t bufLen = 0; // bytes read into client buffer
+static size_t hdrHave = 0; // bytes of mjpeg header held in mjpegHdrStr when header straddles buffers
+static size_t jpegRemain = 0; // bytes of current jpeg still to send
+static uint8_t aviChunkHdr[CHUNK_HDR]; // AVI chunk header when no room for it before jpeg in client buffer
+static size_t iPtr = 0; // pointer in index buffer
+static bool theEnd = false;
 
 // sound recording
 #define SAMPLE_RATE 11025  // 11025Hz sample rate used - adequate for voice
@@ -152,6 +209,8 @@ static uint8_t wavHeader[WAV_HEADER_LEN] = { // WAV header template
 };
 
 int* extractMeta(const char* fname); 
+uint32_t readIndexFooter(File &fh, uint32_t* indexPos);
+uint32_t indexedFrameUs(File &fh);
 void showProgress();  
 
 size_t soundFile(File &fh) {
@@ -170,26 +229,78 @@ size_t soundFile(File &fh) {
   return fileSize; 
 }
 
+static void freeIdx() {
+  // release index buffer and any index spilled to SD
+  if (idxBuf) free(idxBuf);
+  idxBuf = NULL;
+  if (idxFile) {
+    idxFile.close();
+    SD_MMC.remove(AVI_IDX_FILE);
+  }
+  idxBufLen = idxSpilled = 0;
+}
+
+static bool prepIdx() {
+  // allocate pSRAM for idx1 index sized from frame count, and if above IDX_PSRAM_MAX, 
+  // a scratch file on SD to which each full block of index is spilled
+  indexLen = CHUNK_HDR + (frameCnt + (haveSoundFile ? 1 : 0)) * IDX_ENTRY;
+  idxBufLen = (indexLen > IDX_PSRAM_MAX) ? IDX_PSRAM_MAX + IDX_ENTRY : indexLen; // room for entry straddling block
+  idxBuf = (uint8_t*)ps_malloc(idxBufLen);
+  if (idxBuf && indexLen > IDX_PSRAM_MAX) {
+    idxFile = SD_MMC.open(AVI_IDX_FILE, FILE_WRITE);
+  }
+  if (!idxBuf || (indexLen > IDX_PSRAM_MAX && !idxFile)) {
+    Serial.printf("Failed to prepare %zu byte AVI index\n", indexLen);
+    freeIdx();
+    return false;
+  }
+  return true;
+}
+
+void endAVI() {
+  // reset conversion state, releasing index and closing any audio file, at end of upload or when abandoned,
+  // before aviMutex is given
+  bufPos = bufLen = hdrHave = jpegRemain = iPtr = 0;
+  theEnd = false;
+  freeIdx();
+  if (wavFile) wavFile.close();
+  haveSoundFile = false;
+}
+
 bool isAVI(File &fh) {
   // extract file metadata and determine if mjpeg or avi upload
+  endAVI(); // reset any conversion left incomplete
   int* meta = extractMeta(fh.name()); 
-  frameCnt = (uint16_t)meta[3];
+  frameCnt = (uint32_t)meta[3];
   if (!aviOn) frameCnt = 0; // frig to disable AVI conversion if required
+  bool isMjpeg = strstr(fh.name(), ".mjpeg") != NULL;
+  if (!isMjpeg) frameCnt = 0; // eg recorded as AVI
   if (frameCnt > 0) { 
     // presence of frame count in file name indicates file suitable for conversion to AVI
     frameType = (uint8_t)meta[0];
     FPS = (uint8_t)meta[1];
-    fileSize = fh.size();
-    doAVI = true;
-    doAVIheader = true;   
+    // use actual frame interval from frame capture times if available, else file name FPS
+    frameUs = indexedFrameUs(fh);
+    if (!frameUs) frameUs = (uint32_t)round(1000000.0f / FPS);
+    uint32_t indexPos;
+    uint32_t indexed = readIndexFooter(fh, &indexPos); // any frame index trailer is not converted
+    if (indexed) frameCnt = indexed; // actual frame count
+    fileSize = indexPos;
     audSize = soundFile(fh); // get audio file size if present
-    Serial.print("Uploading as AVI");
-    if (audSize) Serial.println(" with audio");
-    else Serial.println("");
-    return true;
+    if (prepIdx()) {
+      doAVI = true;
+      doAVIheader = true;   
+      Serial.printf("Uploading as AVI%s, index uses %zukB pSRAM%s\n", audSize ? " with audio" : "", 
+        idxBufLen / 1024, idxFile ? " and spills to SD" : "");
+      return true;
+    }
+    endAVI();
+    doAVI = false;
+    Serial.println("Uploading as MJPEG instead");
+    return false;
   } else {
     doAVI = false;
-    Serial.println("Uploading as MJPEG");
+    Serial.println(isMjpeg ? "Uploading as MJPEG" : "Uploading as is");
     return false;
   }
 }
@@ -202,189 +313,331 @@ static inline void littleEndian(uint8_t* inBuff, uint32_t in) {
   }
 }
 
-static size_t buildAVIhdr(byte* &clientBuf) {
-  // first call on file, update AVI header template with file specific details
-  size_t moviSize = audSize + (fileSize - (streamBoundaryLen+streamPartLen)*frameCnt - streamBoundaryLen); 
-  size_t aviSize = moviSize + AVI_HEADER_LEN + ((CHUNK_HDR+IDX_ENTRY) * (frameCnt+(haveSoundFile?1:0))); // AVI content size 
-  // update aviHeader with relevant stats
-  littleEndian(aviHeader+4, aviSize);
-  littleEndian(aviHeader+0x20, (uint32_t)round(1000000.0f / FPS)); // usecs_per_frame 
-  littleEndian(aviHeader+0x30, frameCnt);
-  littleEndian(aviHeader+0x8C, frameCnt);
-  littleEndian(aviHeader+0x84, FPS);
-  littleEndian(aviHeader+0x12E, moviSize + ((frameCnt+(haveSoundFile?1:0)) * CHUNK_HDR) + 4); // data size 
-  if (haveSoundFile) littleEndian(aviHeader+0x38, 2); // increase number of streams for audio
-  littleEndian(aviHeader+0x100, audSize); // audio data size
+static inline size_t aviMoviSize() {
+  // size of jpegs and audio, being mjpeg content less its boundaries and part headers
+  return audSize + (fileSize - (streamBoundaryLen+streamPartLen)*frameCnt - streamBoundaryLen); 
+}
+
+size_t aviFileSize() {
+  // size of AVI file that readClientBuf will produce, after isAVI() and before conversion
+  return aviMoviSize() + AVI_HEADER_LEN + ((CHUNK_HDR+IDX_ENTRY) * (frameCnt+(haveSoundFile?1:0))) + CHUNK_HDR; 
+}
+
+void prepAviHeader(uint8_t* hdr, uint8_t frameType, uint32_t frames, uint32_t frameUs, size_t moviLen, size_t fileLen, size_t audLen) {
+  // AVI header from template for given stats, where moviLen is the content of the movi list after its type
+  memcpy(hdr, aviHeader, AVI_HEADER_LEN);
+  littleEndian(hdr+4, fileLen - CHUNK_HDR); // AVI content size, excluding RIFF header
+  littleEndian(hdr+0x20, frameUs); // usecs_per_frame 
+  littleEndian(hdr+0x30, frames);
+  littleEndian(hdr+0x8C, frames);
+  littleEndian(hdr+0x80, frameUs); // frame rate as rate / scale
+  littleEndian(hdr+0x84, 1000000);
+  littleEndian(hdr+0x12E, moviLen + 4); // data size 
+  if (audLen) littleEndian(hdr+0x38, 2); // increase number of streams for audio
+  littleEndian(hdr+0x100, audLen); // audio data size
   // apply video framesize to avi header
-  memcpy(aviHeader+0x40, frameSizeData[frameType].frameWidth, 2);
-  memcpy(aviHeader+0xA8, frameSizeData[frameType].frameWidth, 2);
-  memcpy(aviHeader+0x44, frameSizeData[frameType].frameHeight, 2);
-  memcpy(aviHeader+0xAC, frameSizeData[frameType].frameHeight, 2);
-  
-  memcpy(clientBuf, aviHeader, AVI_HEADER_LEN);
+  memcpy(hdr+0x40, frameSizeData[frameType].frameWidth, 2);
+  memcpy(hdr+0xA8, frameSizeData[frameType].frameWidth, 2);
+  memcpy(hdr+0x44, frameSizeData[frameType].frameHeight, 2);
+  memcpy(hdr+0xAC, frameSizeData[frameType].frameHeight, 2);
+}
+
+static inline void chunkHdr(uint8_t* hdr, const uint8_t* fourcc, uint32_t len) {
+  memcpy(hdr, fourcc, 4);
+  littleEndian(hdr+4, len);
+}
+
+static inline void idxEntry(uint8_t* entry, const uint8_t* fourcc, uint32_t offset, uint32_t len) {
+  // index entry, with offset of chunk from movi list type
+  memcpy(entry, fourcc, 4);
+  memcpy(entry+4, zeroBuf, 4);
+  littleEndian(entry+8, offset); 
+  littleEndian(entry+12, len); 
+}
+
+size_t aviFrameHdr(uint8_t* hdr, uint32_t jpegLen) {
+  // chunk header for jpeg of recording made as AVI
+  chunkHdr(hdr, dcBuf, jpegLen);
+  return CHUNK_HDR;
+}
+
+size_t aviIndexHdr(uint8_t* hdr, uint32_t frames) {
+  // idx1 chunk header for frames of recording made as AVI
+  chunkHdr(hdr, idx1Buf, frames * IDX_ENTRY);
+  return CHUNK_HDR;
+}
+
+size_t aviIndexEntry(uint8_t* entry, uint32_t offset, uint32_t jpegLen) {
+  // idx1 entry for jpeg chunk at given offset in file of recording made as AVI
+  idxEntry(entry, dcBuf, offset - ODML_HEADER_LEN + 4, jpegLen);
+  return IDX_ENTRY;
+}
+
+size_t aviJunkHdr(uint8_t* hdr, uint32_t len) {
+  // header of chunk ignored by media players, used for frame index trailer of recording made as AVI
+  chunkHdr(hdr, junkBuf, len);
+  return CHUNK_HDR;
+}
+
+size_t aviSuperEntry(uint8_t* entry, uint32_t offset, uint32_t len, uint32_t frames) {
+  // OpenDML super index entry, for standard index chunk of given length at offset in file
+  littleEndian(entry, offset);
+  memcpy(entry+4, zeroBuf, 4); // file is under 4GB
+  littleEndian(entry+8, len);
+  littleEndian(entry+12, frames);
+  return IDX_ENTRY;
+}
+
+size_t aviStdIndexHdr(uint8_t* hdr, uint32_t frames, uint32_t baseOffset) {
+  // header of OpenDML standard index chunk for frames, with offsets from baseOffset
+  chunkHdr(hdr, ix00Buf, STD_INDEX_HDR - CHUNK_HDR + frames * STD_INDEX_ENTRY);
+  hdr[8] = STD_INDEX_ENTRY / 4; // longs per entry
+  hdr[9] = 0; // index sub type
+  hdr[10] = 1; // AVI_INDEX_OF_CHUNKS
+  hdr[11] = 0;
+  littleEndian(hdr+12, frames);
+  memcpy(hdr+16, dcBuf, 4);
+  littleEndian(hdr+20, baseOffset);
+  memcpy(hdr+24, zeroBuf, 4); // file is under 4GB
+  memcpy(hdr+28, zeroBuf, 4);
+  return STD_INDEX_HDR;
+}
+
+size_t aviStdIndexEntry(uint8_t* entry, uint32_t offset, uint32_t jpegLen) {
+  // standard index entry for jpeg at offset from base, being a key frame
+  littleEndian(entry, offset);
+  littleEndian(entry+4, jpegLen);
+  return STD_INDEX_ENTRY;
+}
+
+size_t aviRiffHdr(uint8_t* hdr, uint32_t riffLen, uint32_t moviLen) {
+  // headers of OpenDML AVIX RIFF and its movi list, given their overall lengths
+  chunkHdr(hdr, riffBuf, riffLen - CHUNK_HDR);
+  memcpy(hdr+8, avixBuf, 4);
+  chunkHdr(hdr+12, listBuf, moviLen - CHUNK_HDR);
+  memcpy(hdr+20, moviBuf, 4);
+  return 24;
+}
+
+size_t prepOdmlHeader(uint8_t* hdr, uint8_t frameType, uint32_t frames, uint32_t firstFrames, uint32_t frameUs, 
+  size_t moviLen, size_t firstLen, const uint8_t* superIndex, uint32_t superCnt) {
+  // OpenDML AVI header, where moviLen and firstLen are of first RIFF, which holds firstFrames of the frames
+  uint8_t base[AVI_HEADER_LEN];
+  prepAviHeader(base, frameType, firstFrames, frameUs, moviLen, firstLen, 0);
+  littleEndian(base+0x8C, frames); // stream length covers all RIFFs
+  uint8_t* p = hdr;
+  memcpy(p, base, VIDS_STRL_END);
+  littleEndian(hdr+0x10, HDRL_END - 20 + INDX_LEN + ODML_LEN); // hdrl size
+  littleEndian(hdr+0x5C, VIDS_STRL_END - 96 + INDX_LEN); // video strl size
+  p += VIDS_STRL_END;
+  // super index of standard index chunks
+  chunkHdr(p, indxBuf, INDX_LEN - CHUNK_HDR);
+  p[8] = IDX_ENTRY / 4; // longs per entry
+  p[9] = 0; // index sub type
+  p[10] = 0; // AVI_INDEX_OF_INDEXES
+  p[11] = 0;
+  littleEndian(p+12, superCnt);
+  memcpy(p+16, dcBuf, 4);
+  memset(p+20, 0, 12);
+  p += CHUNK_HDR + 24;
+  memcpy(p, superIndex, superCnt * IDX_ENTRY);
+  memset(p + superCnt * IDX_ENTRY, 0, (SUPER_ENTRIES - superCnt) * IDX_ENTRY);
+  p += SUPER_ENTRIES * IDX_ENTRY;
+  // rest of hdrl, then extended header with total frames
+  memcpy(p, base + VIDS_STRL_END, HDRL_END - VIDS_STRL_END);
+  p += HDRL_END - VIDS_STRL_END;
+  chunkHdr(p, listBuf, ODML_LEN - CHUNK_HDR);
+  memcpy(p+8, odmlBuf, 4);
+  chunkHdr(p+12, dmlhBuf, DMLH_LEN);
+  littleEndian(p+20, frames);
+  memset(p+24, 0, DMLH_LEN - 4);
+  p += ODML_LEN;
+  memcpy(p, base + HDRL_END, AVI_HEADER_LEN - HDRL_END); // movi list header
+  return ODML_HEADER_LEN;
+}
+
+static inline uint32_t chunkLen(const uint8_t* hdr) {
+  return hdr[4] | hdr[5] << 8 | hdr[6] << 16 | (uint32_t)hdr[7] << 24;
+}
+
+bool aviMovi(File &fh, uint32_t* moviStart, uint32_t* moviEnd) {
+  // find start of chunks in first movi list of AVI file, and end of chunks in last movi list,
+  // being that of any OpenDML AVIX RIFF, from RIFF and top level chunk headers
+  uint8_t hdr[12];
+  bool found = false;
+  size_t filePos = fh.position();
+  uint32_t riffPos = 0;
+  while (fh.seek(riffPos, SeekSet) && fh.read(hdr, 12) == 12 && !memcmp(hdr, riffBuf, 4) 
+      && !memcmp(hdr+8, riffPos ? avixBuf : aviHeader+8, 4)) {
+    uint32_t riffEnd = std::min((uint32_t)fh.size(), riffPos + CHUNK_HDR + chunkLen(hdr));
+    uint32_t pos = riffPos + 12; // after RIFF header and type
+    while (pos + 12 <= riffEnd && fh.seek(pos, SeekSet) && fh.read(hdr, 12) == 12) {
+      uint32_t len = chunkLen(hdr);
+      if (!memcmp(hdr, listBuf, 4) && !memcmp(hdr+8, moviBuf, 4)) {
+        if (!found) *moviStart = pos + 12;
+        *moviEnd = std::min(riffEnd, pos + CHUNK_HDR + len);
+        found = true;
+        break;
+      }
+      pos += CHUNK_HDR + len + (len & 1);
+    }
+    if (riffEnd <= riffPos + 12) break;
+    riffPos = riffEnd + (riffEnd & 1);
+  }
+  fh.seek(filePos, SeekSet);
+  return found;
+}
+
+static void buildIdx(size_t dataSize, const uint8_t* fourcc = dcBuf) {
+  // build AVI index into buffer - 16 bytes per chunk, spilling each full block to SD for long recordings
+  if (idxSpilled + idxPtr + IDX_ENTRY > indexLen) return; // more frames than expected
+  idxEntry(idxBuf+idxPtr, fourcc, idxOffset, dataSize);
+  idxOffset += dataSize + CHUNK_HDR;
+  idxPtr += IDX_ENTRY; 
+  if (idxFile && idxPtr >= IDX_PSRAM_MAX) {
+    if (idxFile.write(idxBuf, IDX_PSRAM_MAX) != IDX_PSRAM_MAX) Serial.printf("\nERROR: Failed to spill AVI index to %s\n", AVI_IDX_FILE);
+    idxSpilled += IDX_PSRAM_MAX;
+    idxPtr -= IDX_PSRAM_MAX;
+    memcpy(idxBuf, idxBuf+IDX_PSRAM_MAX, idxPtr); // part of entry straddling block
+  }
+}
+
+static size_t buildAVIhdr(byte* &clientBuf) {
+  // first call on file, build AVI header with file specific details
+  size_t chunks = frameCnt+(haveSoundFile?1:0);
+  prepAviHeader(clientBuf, frameType, frameCnt, frameUs, aviMoviSize() + chunks*CHUNK_HDR, aviFileSize(), audSize);
   doAVIheader = false;
   
-  // prep buffer to store index data, gets appended to end of file
-  idxBuf = (uint8_t*)ps_malloc((MAX_FRAMES+1)*IDX_ENTRY); // include some space for audio index
-  memcpy(idxBuf, idx1Buf, 4); // index header
-  littleEndian(idxBuf+4, (frameCnt+(haveSoundFile?1:0))*IDX_ENTRY); // size of index 
+  // prep buffer allocated by isAVI() to store index data, gets appended to end of file
+  chunkHdr(idxBuf, idx1Buf, chunks*IDX_ENTRY); // index header
   idxOffset = 4;
   idxPtr = CHUNK_HDR;
 
   if (haveSoundFile) {
     // add sound file header if required
-    memcpy(clientBuf+AVI_HEADER_LEN, wbBuf, 4); 
-    littleEndian(clientBuf+AVI_HEADER_LEN+4, audSize);
+    chunkHdr(clientBuf+AVI_HEADER_LEN, wbBuf, audSize);
     // add index
-    memcpy(idxBuf+CHUNK_HDR, wbBuf, 4);
-    memcpy(idxBuf+CHUNK_HDR+4, zeroBuf, 4);
-    littleEndian(idxBuf+CHUNK_HDR+8, idxOffset); 
-    littleEndian(idxBuf+CHUNK_HDR+12, audSize); 
-    idxOffset += audSize + CHUNK_HDR;
-    idxPtr += IDX_ENTRY;
+    buildIdx(audSize, wbBuf);
   }
-  indexLen = ((frameCnt+(haveSoundFile?1:0))*IDX_ENTRY)+CHUNK_HDR;
   return AVI_HEADER_LEN+(haveSoundFile?8:0);
 }
 
-static void buildIdx(size_t dataSize) {
-  // build AVI video index into buffer - 16 bytes per frame
-  memcpy(idxBuf+idxPtr, dcBuf, 4);
-  memcpy(idxBuf+idxPtr+4, zeroBuf, 4);
-  littleEndian(idxBuf+idxPtr+8, idxOffset); 
-  littleEndian(idxBuf+idxPtr+12, dataSize); 
-  idxOffset += dataSize + CHUNK_HDR;
-  idxPtr += IDX_ENTRY; 
+static uint8_t aviSegments(byte* clientBuf, segment* segs, uint8_t maxSegs) {
+  // convert mjpeg content of client buffer to AVI segments. Each mjpeg boundary and part header is dropped, 
+  // and the AVI chunk header written over its end, so each jpeg is sent in place with its chunk header
+  uint8_t segCnt = 0;
+  while (bufPos < bufLen && segCnt < maxSegs) {
+    if (jpegRemain) {
+      // jpeg, or its continuation from previous buffer
+      size_t len = std::min(jpegRemain, bufLen - bufPos);
+      if (segCnt && segs[segCnt-1].data + segs[segCnt-1].len == clientBuf + bufPos) segs[segCnt-1].len += len; 
+      else segs[segCnt++] = {clientBuf + bufPos, len};
+      bufPos += len;
+      jpegRemain -= len;
+      continue;
+    }
+    // mjpeg header, held in mjpegHdrStr if it straddles buffers
+    size_t hdrLen = std::min((size_t)MJPEG_HDR - hdrHave, bufLen - bufPos);
+    const char* hdr = (const char*)clientBuf + bufPos;
+    if (hdrHave || hdrLen < MJPEG_HDR) {
+      memcpy(mjpegHdrStr + hdrHave, clientBuf + bufPos, hdrLen);
+      hdr = mjpegHdrStr;
+    }
+    hdrHave += hdrLen;
+    bufPos += hdrLen;
+    if (hdrHave < MJPEG_HDR) break; // rest of header in next buffer, or final boundary
+    hdrHave = 0;
+    // extract jpeg size
+    char lenStr[11];
+    memcpy(lenStr, hdr + LENGTH_OFFSET, 10); // string containing jpeg size
+    lenStr[10] = 0; // terminator
+    jpegRemain = atoi(lenStr); 
+    if (jpegRemain == 0) {
+      Serial.printf("\nERROR: AVI conversion failed on frame: %u\n", framePtr);
+      bufPos = bufLen = iPtr = 0;
+      return 0;
+    }
+    buildIdx(jpegRemain); // build index entry for this jpeg
+    framePtr++;
+    // create AVI header for jpeg, over end of mjpeg header unless that was in previous buffer
+    uint8_t* chunk = (bufPos >= CHUNK_HDR) ? clientBuf + bufPos - CHUNK_HDR : aviChunkHdr;
+    chunkHdr(chunk, dcBuf, jpegRemain);
+    segs[segCnt++] = {chunk, CHUNK_HDR};
+  }
+  return segCnt;
 }
 
-size_t readClientBuf(File &fh, byte* &clientBuf, size_t buffSize) {
-  static int32_t readLen = 0; 
-  static int jStart = 0; // start of current jpeg
-  static int jEnd = 0; // end of current jpeg
-  static int iPtr = 0; // pointer in index buffer
-  static int hdrOffset = 0; // indicates if mjpeg header straddles buffers
-  static bool theEnd = false;
+uint8_t readClientBuf(File &fh, byte* clientBuf, size_t buffSize, segment* segs, uint8_t maxSegs) {
+  // read next part of file into clientBuf of buffSize, and return up to maxSegs segments to send, 
+  // or 0 at end of file. If converting to AVI, segments are generated headers or in place in clientBuf
   showProgress();
     
   if (theEnd) {
     // end of avi file processing, reset for next file
-    theEnd = false;
-    jStart = 0;
-    jEnd = 0; 
-    iPtr = 0;
-    hdrOffset = 0;
-    Serial.printf("\nProcessed %d of %d frames\n", framePtr, frameCnt);
+    Serial.printf("\nProcessed %u of %u frames, index used %zukB pSRAM", framePtr, frameCnt, idxBufLen / 1024);
+    if (idxSpilled) Serial.printf(" and %zukB on SD", idxSpilled / 1024);
+    Serial.println("");
+    endAVI();
     return 0; 
   }
   if (doAVI) {
     // AVI upload, make modifications
     if (doAVIheader) {
       framePtr = 0;
-      return buildAVIhdr(clientBuf);
-      
-    } else {     
-      if (haveSoundFile) {
-        int readLen = wavFile.read(clientBuf, RAMSIZE); // already opened by soundFile()  
-        // if data available return it, else move to next section on completion
-        if (readLen) return readLen; 
-        else {
-          haveSoundFile = false; 
-          wavFile.close();
-        }
+      segs[0] = {clientBuf, buildAVIhdr(clientBuf)};
+      return 1;
+    } 
+    if (haveSoundFile) {
+      size_t readLen = wavFile.read(clientBuf, std::min(buffSize, (size_t)RAMSIZE)); // already opened by soundFile()  
+      // if data available return it, else move to next section on completion
+      if (readLen) {
+        segs[0] = {clientBuf, readLen};
+        return 1;
       }
+      haveSoundFile = false; 
+      wavFile.close();
+    }
 
-      // process video file
-      readLen = fh.available() ? fh.read(clientBuf, buffSize) : 0; // load 32k cluster from SD
-      if (readLen == 0) {
-        // reached end of file, append index data, loop until done
-        size_t sendLen = buffSize;
-        if (indexLen-iPtr > buffSize) {
-          // index bigger than buffer
-          memcpy(clientBuf, idxBuf+iPtr, buffSize);
-          iPtr += buffSize;
-        } else {
-          // final part of index
-          memcpy(clientBuf, idxBuf+iPtr, indexLen-iPtr);
-          sendLen = indexLen-iPtr;
-          free(idxBuf); 
-          theEnd = true;
-        }
-        return sendLen;
-        
-      } else {
-        // get next buffer to modify to remove mjpeg headers and add avi headers 
-        while (true) { // break out of loop when conditions occur
-          if (jEnd < readLen) {
-            // move to mjpeg header
-            if (hdrOffset > 0) {
-              // need to shift up buffer and copy in saved partial mjpeg header 
-              memmove(clientBuf+hdrOffset, clientBuf, buffSize); 
-              memcpy(clientBuf, mjpegHdrStr, hdrOffset); 
-              readLen += hdrOffset;
-              hdrOffset = jEnd = 0;
-            }
-            
-            if (MJPEG_HDR > (readLen-jEnd)) {
-              // remaining buffer content less than mjpeg header block, so postpone to next buffer
-              hdrOffset = (readLen-jEnd);
-              if (hdrOffset > 0) {
-                memcpy(mjpegHdrStr, clientBuf+jEnd, hdrOffset); // string containing partial mjpeg header
-                readLen -= hdrOffset;
-                break;     
-              } // else ignore     
-            }
-
-            jStart = jEnd + LENGTH_OFFSET; // offset from end of previous jpeg    
-            if (jStart > readLen) {
-                jEnd = readLen - jStart; // set -ve as offset to next buffer
-                readLen = jEnd;
-                break;
-            }
-            // extract jpeg size
-            memcpy(mjpegHdrStr, clientBuf+jStart, 10); // string containing jpeg size
-            mjpegHdrStr[10] = 0; // terminator
-            size_t jpegSize = atoi(mjpegHdrStr); 
-            if (jpegSize == 0) {
-              Serial.printf("\nERROR: AVI conversion failed on frame: %u\n", framePtr);
-              jStart = 0;
-              jEnd = 0; 
-              iPtr = 0;
-              hdrOffset = 0;
-              readLen = 0;
-              break;
+    // process video file
+    uint8_t segCnt = 0;
+    while (!segCnt) {
+      if (bufPos == bufLen) {
+        size_t remainLen = fileSize - fh.position(); // stop at any frame index trailer
+        bufLen = remainLen ? fh.read(clientBuf, std::min(buffSize, remainLen)) : 0; // load 32k cluster from SD
+        bufPos = 0;
+        if (bufLen == 0) {
+          // reached end of file, append index data, next call ends
+          if (!idxBuf) return 0;
+          size_t sendLen = std::min(buffSize, indexLen-iPtr);
+          if (iPtr < idxSpilled) {
+            // read back part of index spilled to SD
+            if (!iPtr) {
+              idxFile.close();
+              idxFile = SD_MMC.open(AVI_IDX_FILE, FILE_READ);
             }
-            jStart += REMAINDER_OFFSET;                                        
-            // create AVI header for jpeg
-            memcpy(clientBuf+jEnd, dcBuf, 4); 
-            littleEndian(clientBuf+jEnd+4, jpegSize);
-            buildIdx(jpegSize); // build index entry for this jpeg
-            framePtr++;
-            
-            // shift jpeg data so starts after avi header
-            readLen -= (MJPEG_HDR - CHUNK_HDR); // length of relevant data reduced  
-            memmove(clientBuf+jEnd+CHUNK_HDR, clientBuf+jStart, readLen-jEnd);  
-            // determine end of this jpeg
-            jEnd += CHUNK_HDR + jpegSize;      
-            if (jEnd > readLen) {
-              jEnd -= readLen; // adjust for next buffer 
-              break; 
-              
+            sendLen = idxFile.read(clientBuf, std::min(sendLen, idxSpilled-iPtr));
+            if (!sendLen) {
+              Serial.printf("\nERROR: Failed to read AVI index from %s\n", AVI_IDX_FILE);
+              freeIdx();
+              return 0;
             }
-          } else {
-            // for jpeg bigger than buffer
-            jEnd -= readLen;
-            break;
-          }
-        }   
+            segs[0] = {clientBuf, sendLen};
+          } else segs[0] = {idxBuf+iPtr-idxSpilled, sendLen};
+          iPtr += sendLen;
+          theEnd = iPtr >= indexLen;
+          return 1;
+        }
       }
-      // post loop processing, return modified data for ftp
-      if (readLen < 0) return jStart-LENGTH_OFFSET;  // if reached end of file, send last part of final jpeg 
-      else return readLen; 
-    } 
-  } else {
-    // mjpeg upload, just return what received from SD card
-    return fh.read(clientBuf, buffSize); 
+      segCnt = aviSegments(clientBuf, segs, maxSegs);
+      if (!segCnt && !bufLen) return 0; // conversion failed
+    }
+    return segCnt;
   }
+  // mjpeg upload, just return what received from SD card
+  size_t readLen = fh.read(clientBuf, buffSize);
+  if (!readLen) return 0;
+  segs[0] = {clientBuf, readLen};
+  return 1;
 }
 
 /************** sound recording *******************/
@@ -400,7 +653,7 @@ void IRAM_ATTR onSampleISR() {
   ramBuf[ramPtr] = (uint8_t)(adc1_get_raw(ADC1_CHANNEL_5) >> 4);   
 }
 
-void tranferBufTask(void* parameter) {
+void tranferBufTask(void*) {
   while (true) {
     // periodically transfers half of ram buffer to psram
     static bool bottomDone = false;
@@ -472,7 +725,7 @@ void finishAudio(const char* mjpegName, bool isValid) {
     if (isValid) {
       // build wav file name
       std::string wfile(mjpegName);
-      wfile = std::regex_replace(wfile, std::regex("mjpeg"), "wav");
+      wfile = std::regex_replace(wfile, std::regex("(mjpeg|avi)$"), "wav");
       size_t _psramPtr = (psramPtr%2 == 0) ? psramPtr : --psramPtr; // size needs to be even number of bytes
   
       // update wav header
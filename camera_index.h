@@ -422,6 +422,8 @@ const char* index_ov2640_html = R"~(
               <nav id="maintoolbar">
                   <button id="get-still" style="float:right;">Get Still</button>
                   <button id="toggle-stream" style="float:right;">Start Stream</button>
+                  <button id="watch-recording" style="float:right;">Watch Recording</button>
+                  <button id="play-folder" style="float:right;">Play Folder</button>
               </nav>
             </section>        
             <div id="content">
@@ -463,6 +465,13 @@ const char* index_ov2640_html = R"~(
                               <output name="rangeVal">5</output>
                               <div class="range-max">20</div>
                           </div>
+                          <div class="input-group" id="segMins-group">
+                              <label for="segMins">Segment Mins</label>
+                              <div class="range-min">0</div>
+                              <input type="range" id="segMins" min="0" max="60" value="5" class="default-action">
+                              <output name="rangeVal">5</output>
+                              <div class="range-max">60</div>
+                          </div>
                           <div class="input-group" id="dbg-group">
                               <label for="dbg">Verbose</label>
                               <div class="switch">
@@ -477,9 +486,40 @@ const char* index_ov2640_html = R"~(
                               <option value="/">Get Folders</option>
                             </select>
                           </div>
+                          <div id="gallery" style="display: flex; flex-wrap: wrap;"></div>
+                          <div class="input-group" id="seekSecs-group">
+                              <label for="seekSecs">Playback Secs</label>
+                              <div class="range-min">0</div>
+                              <input type="range" id="seekSecs" min="0" max="60" value="0" class="default-action">
+                              <output name="rangeVal">0</output>
+                              <div class="range-max">60</div>
+                          </div>
+                          <div class="input-group" id="playSpeed-group">
+                              <label for="playSpeed">Playback Speed</label>
+                              <select id="playSpeed" class="default-action">
+                                  <option value="25">0.25x</option>
+                                  <option value="50">0.5x</option>
+                                  <option value="100" selected="selected">1x</option>
+                                  <option value="200">2x</option>
+                                  <option value="400">4x</option>
+                                  <option value="800">8x</option>
+                              </select>
+                          </div>
+                          <div class="input-group" id="playStep-group">
+                              <label for="playStep">Fast Forward</label>
+                              <select id="playStep" class="default-action">
+                                  <option value="1" selected="selected">Off</option>
+                                  <option value="2">2x</option>
+                                  <option value="4">4x</option>
+                                  <option value="8">8x</option>
+                                  <option value="16">16x</option>
+                                  <option value="32">32x</option>
+                              </select>
+                          </div>
                           <section id="buttons"><br>
                             <button id="upload" style="float:left; " value="1">Ftp Upload</button>
                             <button id="uploadMove" style="float:left; " value="1">Ftp Move</button>
+                            <button id="download" style="float:left; " value="1">Download</button>
                             <button id="delete" style="float:right; " value="1">Delete</button>
                           </section><br>
                           <div class="input-group" id="aviOn-group">
@@ -496,6 +536,34 @@ const char* index_ov2640_html = R"~(
                               <output name="rangeVal">10</output>
                               <div class="range-max">63</div>
                           </div>
+                          <div class="input-group" id="autoQ-group">
+                              <label for="autoQ">Auto Quality</label>
+                              <div class="switch">
+                                  <input id="autoQ" type="checkbox" class="default-action">
+                                  <label class="slider" for="autoQ"></label>
+                              </div>
+                          </div>
+                          <div class="input-group" id="aviRecord-group">
+                              <label for="aviRecord">Record avi</label>
+                              <div class="switch">
+                                  <input id="aviRecord" type="checkbox" class="default-action">
+                                  <label class="slider" for="aviRecord"></label>
+                              </div>
+                          </div>
+                          <div class="input-group" id="qmin-group">
+                              <label for="qmin">Best Quality</label>
+                              <div class="range-min">10</div>
+                              <input type="range" id="qmin" min="10" max="63" value="10" class="default-action">
+                              <output name="rangeVal">10</output>
+                              <div class="range-max">63</div>
+                          </div>
+                          <div class="input-group" id="qmax-group">
+                              <label for="qmax">Worst Quality</label>
+                              <div class="range-min">10</div>
+                              <input type="range" id="qmax" min="10" max="63" value="30" class="default-action">
+                              <output name="rangeVal">30</output>
+                              <div class="range-max">63</div>
+                          </div>
                           <div class="input-group" id="record-group">
                               <label for="record">Save Capture</label>
                               <div class="switch">
@@ -879,6 +947,7 @@ document.addEventListener('DOMContentLoaded', function (event) {
 
   var baseHost = document.location.origin
   var streamUrl = baseHost + ':81'
+  var playSid = 0 // playback session id of this tab, returned when a recording is selected
 
   const hide = el => {
     el.classList.add('hidden')
@@ -897,6 +966,10 @@ document.addEventListener('DOMContentLoaded', function (event) {
     el.disabled = false
   }
 
+  const isRecording = name => {
+    return name.endsWith(".mjpeg") || name.endsWith(".avi")
+  }
+
   const updateValue = (el, value, updateRemote) => {
     updateRemote = updateRemote == null ? true : updateRemote
     let initialValue
@@ -978,7 +1051,7 @@ document.addEventListener('DOMContentLoaded', function (event) {
         return
     }
     
-    const query = `${baseHost}/control?var=${el.id}&val=${value}`
+    const query = `${baseHost}/control?var=${el.id}&val=${value}&sid=${playSid}`
     const encoded = encodeURI(query);
     console.log(`Encoded request ${query}`)
     fetch(encoded)
@@ -996,7 +1069,7 @@ document.addEventListener('DOMContentLoaded', function (event) {
     })
 
   // read initial values
-  fetch(`${baseHost}/status`)
+  fetch(`${baseHost}/status?sid=${playSid}`)
     .then(function (response) {
       return response.json()
     })
@@ -1012,10 +1085,13 @@ document.addEventListener('DOMContentLoaded', function (event) {
   const viewContainer = document.getElementById('stream-container')
   const stillButton = document.getElementById('get-still')
   const streamButton = document.getElementById('toggle-stream')
+  const tailButton = document.getElementById('watch-recording')
+  const folderButton = document.getElementById('play-folder')
   const closeButton = document.getElementById('close-stream')  
   const uploadButton = document.getElementById('upload')    
   const uploadMoveButton = document.getElementById('uploadMove')    
   const deleteButton = document.getElementById('delete') 
+  const downloadButton = document.getElementById('download') 
   const rebootButton = document.getElementById('reboot')
   const saveButton = document.getElementById('save')
   const defaultsButton = document.getElementById('defaults')
@@ -1029,6 +1105,13 @@ document.addEventListener('DOMContentLoaded', function (event) {
     updateConfig(uploadMoveButton);
   }
   
+  downloadButton.onclick = () => {
+    // download selected recording, mjpeg as AVI if Upload avi selected
+    if (!isRecording(downloadButton.value)) return false;
+    window.location.href = baseHost + '/file?name=' + encodeURIComponent(downloadButton.value) 
+      + '&avi=' + ($('#aviOn').is(':checked') ? 1 : 0);
+  }
+  
   deleteButton.onclick = () => {
     var deleteBt = $('#delete');
     if(!confirm("Are you sure you want to delete " + deleteBt.val() + " from the SD card?"))
@@ -1090,13 +1173,14 @@ document.addEventListener('DOMContentLoaded', function (event) {
       url: baseHost + '/control',
       data: {
         "var": "stopStream",
-        "val": "1"
+        "val": "1",
+        "sid": playSid
       }
     })
   }
 
   const startStream = () => {
-    view.src = `${streamUrl}/stream`
+    view.src = `${streamUrl}/stream?sid=${playSid}`
     show(viewContainer)
     streamButton.innerHTML = 'Stop Stream'
   }
@@ -1113,6 +1197,69 @@ document.addEventListener('DOMContentLoaded', function (event) {
     hide(viewContainer)
   }
 
+  tailButton.onclick = () => {
+    // stream recording in progress from its start at current playback speed, else live view
+    stopStream()
+    $.ajax({
+      url: baseHost + '/control',
+      data: {
+        "var": "tail",
+        "val": "1",
+        "sid": playSid
+      },
+      success: function(response) {
+        playSid = response.sid
+        $.ajax({
+          url: baseHost + '/control',
+          data: {
+            "var": "playSpeed",
+            "val": $('#playSpeed').val(),
+            "sid": playSid
+          },
+          complete: startStream
+        })
+      }
+    })
+  }
+
+  folderButton.onclick = () => {
+    // stream each recording in selected day folder back to back, at current playback speed and fast forward
+    var selection = $('#sfile').val();
+    var folder = isRecording(selection) ? selection.substring(0, selection.lastIndexOf("/")) : selection;
+    if (folder == "" || folder == "/" || folder == "None") return;
+    stopStream()
+    $.ajax({
+      url: baseHost + '/control',
+      data: {
+        "var": "playFolder",
+        "val": folder,
+        "sid": playSid
+      },
+      success: function(response) {
+        playSid = response.sid
+        $.ajax({
+          url: baseHost + '/control',
+          data: {
+            "var": "playSpeed",
+            "val": $('#playSpeed').val(),
+            "sid": playSid
+          },
+          complete: function() {
+            $.ajax({
+              url: baseHost + '/control',
+              data: {
+                "var": "playStep",
+                "val": $('#playStep').val(),
+                "sid": playSid
+              },
+              complete: startStream
+            })
+          }
+        })
+      }
+    })
+  }
+
   streamButton.onclick = () => {
     const streamEnabled = streamButton.innerHTML === 'Stop Stream'
     if (streamEnabled) {
@@ -1204,22 +1351,55 @@ document.addEventListener('DOMContentLoaded', function (event) {
     document.getElementById('delete').value = selection; //Store file path for delete
     document.getElementById('upload').value = selection; //Store file path for ftp upload
     document.getElementById('uploadMove').value = selection; //Store file path for ftp upload move
+    document.getElementById('download').value = selection; //Store file path for download
     var listItems = '';
     //Not a file list
     var pathDir = selection.substring(0,selection.lastIndexOf("/"))
+    if (isRecording(selection)) {
+      // scale playback scrub bar to recording duration from file name
+      var secs = parseInt(selection.split(/[_.]/)[4]) || 60;
+      var seek = $('#seekSecs');
+      seek.attr('max', secs).val(0);
+      seek.siblings('.range-max').text(secs);
+    }
     if(pathDir=="") sid.find('option:not(:first)').remove(); // remove all except first option
     $.ajax({
       url: baseHost + '/control',
       data: {
         "var": "sfile",
-        "val": selection
+        "val": selection,
+        "sid": playSid
       },   
       success: function(response) {
-        // create new option list from json
-        $.each(response, function(key, value){
+        // playback session of selected recording, else create new option list from json
+        if (isRecording(selection)) playSid = response.sid;
+        else $.each(response, function(key, value){
           listItems += '<option value="' + key + '">' + value + '</option>';
         });
         sid.append(listItems);
+        if (!isRecording(selection)) {
+          // thumbnail of each recording in folder, click to select it
+          var gallery = $('#gallery').empty();
+          $.each(response, function(key, value){
+            if (!isRecording(key)) return;
+            $('<img loading="lazy" style="width: 100px; margin: 1px; cursor: pointer;">')
+              .attr({src: baseHost + '/thumb?name=' + encodeURIComponent(key), title: value})
+              .on('error', function(){ $(this).remove(); }) // recording without thumbnail
+              .on('click', function(){ sid.val(key); sfile.onchange(); })
+              .appendTo(gallery);
+          });
+        }
+        // apply current playback speed and fast forward to selected recording
+        if (isRecording(selection)) ['playSpeed', 'playStep'].forEach(function(id){
+          $.ajax({
+            url: baseHost + '/control',
+            data: {
+              "var": id,
+              "val": $('#' + id).val(),
+              "sid": playSid
+            }
+          });
+        });
       }
     }); 
   }
@@ -0,0 +1,448 @@
+/*
+ Host benchmark driver for the recording, playback and AVI conversion pipeline.
+
+ mjpeg2sd.cpp is included unchanged so that its static functions and state
+ (processFrame, saveFrame, fb, sessions etc) can be driven directly.
+ avi.cpp and motionDetect.cpp are compiled as separate units, as in the sketch.
+ See README.md in this folder for usage.
+*/
+
+#include "../../mjpeg2sd.cpp"
+#include <getopt.h>
+#include <vector>
+
+bool isAVI(File &fh);
+uint8_t readClientBuf(File &fh, byte* clientBuf, size_t buffSize, segment* segs, uint8_t maxSegs);
+size_t aviFileSize();
+
+#define AVI_BUFF_SIZE (32 * 1024) // as ftp.cpp
+#define AVI_SEGS 32 // as UPLOAD_SEGS in ftp.cpp
+
+class Timings {
+  // per call timings in usecs, summarised as percentiles
+  public:
+    Timings(const char* _label) : label(_label) {}
+    void start() { t0 = micros(); }
+    void stop() { samples.push_back(micros() - t0); }
+    void report(size_t bytes = 0) {
+      if (samples.empty()) return;
+      std::vector<uint32_t> sorted(samples);
+      std::sort(sorted.begin(), sorted.end());
+      uint64_t total = 0;
+      for (auto s : sorted) total += s;
+      printf("%-13s calls %6u  avg %7.0fus  p50 %7uus  p90 %7uus  p99 %7uus  max %7uus  total %7.1fms",
+        label, (unsigned)sorted.size(), (double)total / sorted.size(), pct(sorted, 50), pct(sorted, 90),
+        pct(sorted, 99), sorted.back(), total / 1000.0);
+      if (bytes && total) printf("  %0.1f MB/s", (double)bytes / total);
+      printf("\n");
+    }
+  private:
+    static uint32_t pct(const std::vector<uint32_t>& sorted, int p) {
+      return sorted[std::min(sorted.size() - 1, sorted.size() * p / 100)];
+    }
+    const char* label;
+    unsigned long t0;
+    std::vector<uint32_t> samples;
+};
+
+static void usage(const char* prog) {
+  printf("Usage: %s [options] save|process|capture|tail|play|avi|index|walk\n"
+    "  save     openMjpeg, saveFrame per frame, closeMjpeg\n"
+    "  process  processFrame per frame, recording driven by motion detection\n"
+    "  capture  captureTask driven by the frame timer in real time\n"
+    "  tail     as capture, with -p sessions watching the recording in progress\n"
+    "  play     getNextFrame over a recording, paced, in -p concurrent sessions\n"
+    "  avi      readClientBuf over a recording, writing the AVI to the card\n"
+    "  index    read -n random frames of a recording using its frame index\n"
+    "  walk     find frames in playback buffers of a recording -n times, by search and frame walker\n"
+    "Options:\n"
+    "  -j dir   directory of JPEG frames to replay (default synthetic frames)\n"
+    "  -s dir   host directory used as SD card (default ./sdcard)\n"
+    "  -z n     frame size index, 0 (96X96) .. 13 (UXGA) (default 9 SVGA)\n"
+    "  -c fps   camera frame rate, 0 for unpaced (default 0, capture and tail default 25)\n"
+    "  -r fps   recording FPS (default for frame size)\n"
+    "  -b n     camera frame buffers (default 4)\n"
+    "  -w us    SD card latency per write (default 0)\n"
+    "  -g ms    SD card stall every %u writes (default 0)\n"
+    "  -n n     frames to save or process, or seconds for capture or tail (default 200)\n"
+    "  -f file  recording path on card, for play, avi and index, or day folder to play (default last recorded)\n"
+    "  -q b,w   auto jpeg quality between best b and worst w\n"
+    "  -k n     for play, seek to frame n after first frame\n"
+    "  -K secs  for play, seek to secs after first frame\n"
+    "  -p n     for play or tail, concurrent playback sessions (default 1)\n"
+    "  -x pct   for play or tail, playback speed as %% of recorded rate (default 100)\n"
+    "  -X n     for play, fast forward sending 1 in n frames (default 1)\n"
+    "  -S secs  segment length of recording, 0 for MAX_FRAMES only (default 300)\n"
+    "  -a       record as AVI, as aviRecord\n"
+    "  -l       print latency histograms json, as served on /latency\n"
+    "  -v       verbose, sets debug\n", prog, SIM_STALL_WRITES);
+}
+
+static void lastRecording(char* fname) {
+  // most recent recording in most recent day folder
+  fname[0] = 0;
+  File root = SD_MMC.open("/");
+  String day = "";
+  for (File f = root.openNextFile(); f; f = root.openNextFile())
+    if (f.isDirectory() && day < String(f.name())) day = f.name();
+  if (day == "") return;
+  File dir = SD_MMC.open(day.c_str());
+  for (File f = dir.openNextFile(); f; f = dir.openNextFile())
+    if (isRecording(f.name()) && strcmp(fname, f.name()) < 0) strcpy(fname, f.name());
+}
+
+static void benchSave(int numFrames) {
+  Timings tGet("fb_get"), tSave("saveFrame"), tClose("closeMjpeg");
+  minSeconds = 0;
+  openMjpeg();
+  uint64_t bytes = 0;
+  for (int i = 0; i < numFrames; i++) {
+    xSemaphoreTake(frameMutex, portMAX_DELAY);
+    tGet.start();
+    fb = esp_camera_fb_get();
+    tGet.stop();
+    if (!fb) break;
+    bytes += fb->len;
+    tSave.start();
+    saveFrame(); // also frees frame
+    tSave.stop();
+  }
+  tClose.start();
+  closeMjpeg();
+  tClose.stop();
+  tGet.report();
+  tSave.report(bytes);
+  tClose.report();
+}
+
+static void benchProcess(int numFrames) {
+  Timings tProcess("processFrame");
+  minSeconds = 0;
+  for (int i = 0; i < numFrames; i++) {
+    tProcess.start();
+    processFrame();
+    tProcess.stop();
+  }
+  if (isCapturing) {
+    // force close recording still in progress
+    stopPlayback = true;
+    closeMjpeg();
+    isCapturing = stopPlayback = false;
+  }
+  tProcess.report();
+}
+
+static void benchCapture(int seconds) {
+  minSeconds = 0;
+  startSDtasks();
+  setFPS(FPS);
+  delay(seconds * 1000);
+  controlFrameTimer(false);
+  delay(500); // let captureTask finish current frame
+  if (isCapturing) {
+    stopPlayback = true;
+    closeMjpeg();
+    isCapturing = stopPlayback = false;
+  }
+}
+
+struct benchSession {
+  uint32_t sid;
+  int seekFrame, seekSecs;
+  Timings* tNext;
+  uint64_t bytes;
+  volatile bool done;
+};
+
+static void benchSessionTask(void* parameter) {
+  // stream one playback session, as the stream handler task in app_httpd.cpp
+  benchSession* b = (benchSession*)parameter;
+  playSession* s = startPlayback(b->sid);
+  while (s) {
+    size_t frameLen;
+    b->tNext->start();
+    const uint8_t* frame = getNextFrame(s, &frameLen);
+    b->tNext->stop();
+    if (!frame) break;
+    b->bytes += frameLen;
+    if (b->seekFrame >= 0) seekPlayback(b->sid, b->seekFrame, false);
+    else if (b->seekSecs >= 0) seekPlayback(b->sid, b->seekSecs * 1000, true);
+    b->seekFrame = b->seekSecs = -1;
+  }
+  if (s) endPlayback(s);
+  b->done = true;
+  vTaskDelete(NULL);
+}
+
+static void startSessions(benchSession* bench, int sessionCnt, bool tail, int seekFrame, int seekSecs, int speed, int step) {
+  // concurrent playback sessions, each for a different browser tab, of the same recording or of the recording in progress
+  static char labels[MAX_SESSIONS][24];
+  for (int i = 0; i < sessionCnt; i++) {
+    snprintf(labels[i], sizeof(labels[i]), "getNextFrame%d", i + 1);
+    bench[i] = {0, seekFrame, seekSecs, new Timings(labels[i]), 0, false};
+    bench[i].sid = tail ? selectTail(0) : selectPlayback(0, mjpegName, false, !isRecording(mjpegName));
+    if (!bench[i].sid) bench[i].done = true;
+    else {
+      playbackSpeed(bench[i].sid, speed);
+      playbackStep(bench[i].sid, step);
+      xTaskCreate(&benchSessionTask, "benchSession", 4096, &bench[i], 3, NULL);
+    }
+  }
+}
+
+static void finishSessions(benchSession* bench, int sessionCnt) {
+  // wait for sessions to end, then report
+  for (int i = 0; i < sessionCnt; i++) while (!bench[i].done) delay(10);
+  for (int i = 0; i < sessionCnt; i++) {
+    bench[i].tNext->report(bench[i].bytes);
+    delete bench[i].tNext;
+  }
+}
+
+static void benchPlay(int sessionCnt, int seekFrame, int seekSecs, int speed, int step) {
+  // concurrent playback sessions of the same recording or day folder
+  benchSession bench[MAX_SESSIONS];
+  sessionCnt = std::min(sessionCnt, MAX_SESSIONS);
+  xTaskCreate(&playbackTask, "playbackTask", 4096, NULL, 4, &playbackHandle);
+  startSessions(bench, sessionCnt, false, seekFrame, seekSecs, speed, step);
+  finishSessions(bench, sessionCnt);
+}
+
+static void benchTail(int seconds, int sessionCnt, int speed) {
+  // as capture, with tail sessions watching the recording from when it starts
+  benchSession bench[MAX_SESSIONS];
+  sessionCnt = std::min(sessionCnt, MAX_SESSIONS);
+  minSeconds = 0;
+  startSDtasks();
+  setFPS(FPS);
+  uint32_t startTime = millis();
+  while (!stopPlayback && millis() - startTime < (uint32_t)seconds * 1000) delay(10);
+  if (!stopPlayback) showError("No recording started");
+  startSessions(bench, sessionCnt, true, -1, -1, speed, 1);
+  int32_t remaining = seconds * 1000 - (millis() - startTime);
+  if (remaining > 0) delay(remaining);
+  controlFrameTimer(false);
+  delay(500); // let captureTask finish current frame
+  if (isCapturing) {
+    stopPlayback = true;
+    closeMjpeg();
+    isCapturing = stopPlayback = false;
+  }
+  finishSessions(bench, sessionCnt);
+}
+
+static void benchIndex(int numSeeks) {
+  // seek to random frames using frame index trailer, and check each is a jpeg
+  Timings tSeek("readFrame");
+  File fh = SD_MMC.open(mjpegName, FILE_READ);
+  uint32_t indexPos;
+  uint32_t frames = readIndexFooter(fh, &indexPos);
+  if (!frames) {
+    showError("%s has no frame index", mjpegName);
+    return;
+  }
+  bool avi = isAviFile(mjpegName);
+  size_t hdrLen = avi ? AVI_CHUNK_HDR : frameHdrLen;
+  uint8_t* jpeg = (uint8_t*)malloc(MAX_JPEG + frameHdrLen);
+  frameIndexEntry entry;
+  uint64_t bytes = 0;
+  int bad = 0;
+  srand(1);
+  for (int i = 0; i < numSeeks; i++) {
+    uint32_t frameNum = rand() % frames;
+    tSeek.start();
+    bool ok = readFrameEntry(fh, indexPos, frameNum, &entry) && entry.len <= MAX_JPEG
+      && fh.read(jpeg, hdrLen + entry.len) == hdrLen + entry.len;
+    tSeek.stop();
+    uint8_t* j = jpeg + hdrLen;
+    if (!ok || memcmp(jpeg, avi ? "00dc" : _STREAM_BOUNDARY, avi ? 4 : streamBoundaryLen) || j[0] != 0xFF || j[1] != 0xD8 
+      || j[entry.len-2] != 0xFF || j[entry.len-1] != 0xD9) bad++;
+    bytes += entry.len;
+  }
+  free(jpeg);
+  readFrameEntry(fh, indexPos, frames - 1, &entry);
+  fh.close();
+  showInfo("%u frames indexed, last at %u ms, %d of %d seeks not a jpeg", frames, entry.time, bad, numSeeks);
+  tSeek.report(bytes);
+}
+
+static size_t naiveSubArray(uint8_t* haystack, uint8_t* needle, size_t hSize, size_t nSize) { 
+  // byte by byte boundary search previously used by getNextFrame, for comparison
+  size_t h = 0, n = 0;
+  while (h < hSize && n < nSize) { 
+    if (haystack[h] == needle[n]) { 
+      h++; 
+      n++; 
+      if (n == nSize) return h;
+    } else { 
+      h = h - n + 1; 
+      n = 0; 
+    } 
+  } 
+  return 0;
+} 
+
+static void benchWalk(int passes) {
+  // find frames in each playback buffer of a recording, by boundary search and by frame walker
+  Timings tNaive("naive search"), tSearch("isSubArray"), tWalk("walkFrame");
+  if (isAviFile(mjpegName)) {
+    showError("%s is not an mjpeg", mjpegName);
+    return;
+  }
+  File fh = SD_MMC.open(mjpegName, FILE_READ);
+  uint32_t endPos;
+  readIndexFooter(fh, &endPos);
+  std::vector<uint8_t> content(endPos);
+  fh.read(content.data(), endPos);
+  fh.close();
+  uint32_t naiveFrames = 0, searchFrames = 0, walkFrames = 0;
+  frameWalker walker;
+  for (int i = 0; i < passes; i++) {
+    naiveFrames = searchFrames = walkFrames = 0;
+    walker = {streamBoundaryLen, false, false, 0, {0}, false, false};
+    for (size_t pos = 0; pos < endPos; pos += sdBlockSize) {
+      uint8_t* buff = content.data() + pos;
+      size_t buffLen = std::min((size_t)sdBlockSize, endPos - pos);
+      size_t offset, found;
+      tNaive.start();
+      for (offset = 0; (found = naiveSubArray(buff + offset, (uint8_t*)needle, buffLen - offset, streamBoundaryLen)); offset += found) naiveFrames++;
+      tNaive.stop();
+      tSearch.start();
+      for (offset = 0; (found = isSubArray(buff + offset, (uint8_t*)needle, buffLen - offset, streamBoundaryLen)); offset += found) searchFrames++;
+      tSearch.stop();
+      tWalk.start();
+      for (offset = 0; offset < buffLen; ) {
+        bool frameEnd;
+        offset += walkFrame(&walker, buff + offset, buffLen - offset, &frameEnd);
+        walkFrames += frameEnd;
+      }
+      tWalk.stop();
+    }
+  }
+  // boundary searches also find leading boundary, and miss boundaries split across buffers
+  showInfo("%s: %u bytes in %zu byte buffers, boundaries found by naive search %u, isSubArray %u, frames walked %u",
+    mjpegName, endPos, sdBlockSize, naiveFrames, searchFrames, walkFrames);
+  tNaive.report((uint64_t)endPos * passes);
+  tSearch.report((uint64_t)endPos * passes);
+  tWalk.report((uint64_t)endPos * passes);
+}
+
+static void benchAVI() {
+  Timings tRead("readClientBuf");
+  File fh = SD_MMC.open(mjpegName, FILE_READ);
+  if (!fh || !isAVI(fh)) {
+    showError("%s not convertible to AVI", mjpegName);
+    return;
+  }
+  size_t aviSize = aviFileSize();
+  std::string aviName = std::regex_replace(std::string(mjpegName), std::regex(MJPEGEXT), "avi");
+  File aviFile = SD_MMC.open(aviName.c_str(), FILE_WRITE);
+  byte* clientBuf = (byte*)ps_malloc(AVI_BUFF_SIZE);
+  segment segs[AVI_SEGS];
+  uint8_t segCnt;
+  uint64_t bytes = 0, calls = 0, segTotal = 0;
+  do {
+    tRead.start();
+    segCnt = readClientBuf(fh, clientBuf, AVI_BUFF_SIZE, segs, AVI_SEGS);
+    tRead.stop();
+    for (int i = 0; i < segCnt; i++) {
+      aviFile.write(segs[i].data, segs[i].len);
+      bytes += segs[i].len;
+    }
+    calls++;
+    segTotal += segCnt;
+  } while (segCnt);
+  free(clientBuf);
+  aviFile.close();
+  fh.close();
+  showInfo("Wrote %s, %llu bytes, expected %zu, %0.1f segments per call", aviName.c_str(), (unsigned long long)bytes, aviSize, 
+    (float)segTotal / std::max(calls, (uint64_t)1));
+  tRead.report(bytes);
+}
+
+int main(int argc, char** argv) {
+  const char* jpegDir = NULL;
+  const char* playFile = NULL;
+  int frameSize = FRAMESIZE_SVGA;
+  float camFps = -1;
+  int recFps = 0;
+  int fbCnt = 4;
+  int count = 200;
+  bool showLatency = false;
+  int seekFrame = -1, seekSecs = -1, sessionCnt = 1, speed = 100, step = 1;
+  int opt;
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  while ((opt = getopt(argc, argv, "j:s:z:c:r:b:w:g:n:f:q:k:K:p:x:X:S:alv")) != -1) {
+    switch (opt) {
+      case 'j': jpegDir = optarg; break;
+      case 's': simSdRoot = optarg; break;
+      case 'z': frameSize = atoi(optarg); break;
+      case 'c': camFps = atof(optarg); break;
+      case 'r': recFps = atoi(optarg); break;
+      case 'b': fbCnt = atoi(optarg); break;
+      case 'w': simWriteUs = atoi(optarg); break;
+      case 'g': simStallMs = atoi(optarg); break;
+      case 'n': count = atoi(optarg); break;
+      case 'f': playFile = optarg; break;
+      case 'q': 
+        autoQuality = sscanf(optarg, "%hhu,%hhu", &qualityMin, &qualityMax) == 2; 
+        break;
+      case 'k': seekFrame = atoi(optarg); break;
+      case 'K': seekSecs = atoi(optarg); break;
+      case 'p': sessionCnt = atoi(optarg); break;
+      case 'x': speed = atoi(optarg); break;
+      case 'X': step = atoi(optarg); break;
+      case 'S': segmentSecs = atoi(optarg); break;
+      case 'a': aviRecord = true; break;
+      case 'l': showLatency = true; break;
+      case 'v': debug = true; break;
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if (optind >= argc || frameSize < 0 || frameSize >= frameDataRows) {
+    usage(argv[0]);
+    return 1;
+  }
+  const char* mode = argv[optind];
+  if (camFps < 0) camFps = strcmp(mode, "capture") && strcmp(mode, "tail") ? 0 : 25;
+
+  if (!simCameraInit(jpegDir, camFps, (framesize_t)frameSize, fbCnt)) return 1;
+  fsizePtr = frameSize;
+  fbCount = fbCnt;
+  FPS = recFps ? recFps : frameData[fsizePtr].defaultFPS;
+  if (!prepSD_MMC() || !prepMjpeg()) return 1;
+
+  if (!strcmp(mode, "save") || !strcmp(mode, "process")) {
+    // else by startSDtasks()
+    xTaskCreate(&writerTask, "writerTask", 4096, NULL, 4, &writerHandle);
+    xTaskCreate(&thumbTask, "thumbTask", 4096, NULL, 1, &thumbHandle);
+  }
+  if (!strcmp(mode, "save")) benchSave(count);
+  else if (!strcmp(mode, "process")) benchProcess(count);
+  else if (!strcmp(mode, "capture")) benchCapture(count);
+  else if (!strcmp(mode, "tail")) benchTail(count, sessionCnt, speed);
+  else if (!strcmp(mode, "play") || !strcmp(mode, "avi") || !strcmp(mode, "index") || !strcmp(mode, "walk")) {
+    if (playFile) strcpy(mjpegName, playFile);
+    else lastRecording(mjpegName);
+    if (!mjpegName[0]) {
+      showError("No recording found on %s", simSdRoot);
+      return 1;
+    }
+    if (!strcmp(mode, "play")) benchPlay(sessionCnt, seekFrame, seekSecs, speed, step);
+    else if (!strcmp(mode, "avi")) benchAVI();
+    else if (!strcmp(mode, "walk")) benchWalk(count);
+    else benchIndex(count);
+  } else {
+    usage(argv[0]);
+    return 1;
+  }
+  while (uxQueueMessagesWaiting(thumbQueue)) delay(10); // let thumbTask finish
+  uint32_t delivered, skipped;
+  simCameraStats(&delivered, &skipped);
+  if (delivered) showInfo("Camera delivered %u frames, skipped %u", delivered, skipped);
+  if (showLatency) {
+    latencyStats(htmlBuff);
+    showInfo("%s", htmlBuff);
+  }
+  return 0;
+}
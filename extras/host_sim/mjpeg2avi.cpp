@@ -0,0 +1,225 @@
+/*
+ Host bulk converter of archived mjpeg recordings to AVI.
+
+ Each recording is converted by isAVI() and readClientBuf() of avi.cpp, unchanged,
+ with any .wav file of the recording merged, so the AVI is byte identical to that
+ uploaded by ftp.cpp or downloaded from /file?avi=1.
+ The conversion state in avi.cpp is global as on the ESP32, so recordings are
+ converted in parallel by a pool of worker processes, each taking the next
+ recording from a shared counter. Recordings are memory mapped.
+ See README.md in this folder for usage.
+*/
+
+#include "Arduino.h"
+#include "SD_MMC.h"
+#include <atomic>
+#include <dirent.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+struct segment {
+  const uint8_t* data;
+  size_t len;
+}; // as in mjpeg2sd.cpp
+bool isAVI(File &fh);
+uint8_t readClientBuf(File &fh, byte* clientBuf, size_t buffSize, segment* segs, uint8_t maxSegs);
+size_t aviFileSize();
+extern bool debug;
+
+#define CONV_BUFF_SIZE (32 * 1024) // as BUFF_SIZE in ftp.cpp
+#define CONV_SEGS 32 // as UPLOAD_SEGS in ftp.cpp
+#define ONEMEG (1024*1024) // as mjpeg2sd.cpp
+#define OUT_BUFF_SIZE ONEMEG // host write buffer per output file
+
+enum convStatus : int8_t {CONV_PENDING, CONV_DONE, CONV_EXISTS, CONV_FAILED};
+
+struct convResult {
+  uint64_t inBytes; // recording and any wav file
+  uint64_t outBytes;
+  uint32_t usecs;
+  convStatus status;
+};
+
+struct convPool {
+  // shared between worker processes
+  std::atomic<uint32_t> next; // next recording to convert
+  convResult results[1]; // one per recording, allocated beyond struct
+};
+
+static void usage(const char* prog) {
+  printf("Usage: %s [options] file.mjpeg|folder ...\n"
+    "Converts each mjpeg recording, or those below each folder, to an AVI alongside it,\n"
+    "merging any .wav file of the same name, as uploaded by FTP with aviOn\n"
+    "Options:\n"
+    "  -j n     worker processes (default number of cpus)\n"
+    "  -o dir   host folder for the AVI files (default folder of each recording)\n"
+    "  -f       replace existing AVI files, else recordings with one are skipped\n"
+    "  -v       verbose, show conversion output of each recording\n", prog);
+}
+
+static bool endsWith(const std::string& str, const char* ext) {
+  size_t extLen = strlen(ext);
+  return str.size() > extLen && !str.compare(str.size() - extLen, extLen, ext);
+}
+
+static void findRecordings(const std::string& path, std::vector<std::string>& files) {
+  // add path if a recording, else recordings below path if a folder
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) printf("%s not found\n", path.c_str());
+  else if (S_ISREG(st.st_mode)) {
+    if (endsWith(path, ".mjpeg")) files.push_back(path);
+    else printf("%s is not an mjpeg recording\n", path.c_str());
+  } else if (S_ISDIR(st.st_mode)) {
+    DIR* dir = opendir(path.c_str());
+    if (!dir) return;
+    std::vector<std::string> names;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL)
+      if (entry->d_name[0] != '.') names.push_back(entry->d_name);
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    for (auto& name : names) {
+      std::string epath = path + (endsWith(path, "/") ? "" : "/") + name;
+      if (stat(epath.c_str(), &st) != 0) continue;
+      if (S_ISDIR(st.st_mode) || endsWith(name, ".mjpeg")) findRecordings(epath, files);
+    }
+  }
+}
+
+static convStatus convertFile(const std::string& path, const char* outDir, bool replace, convResult* result) {
+  // convert recording at host path to AVI. The card root is set to the folder of the recording,
+  // so that avi.cpp sees the name and finds the wav file as on the ESP32
+  size_t slash = path.rfind('/');
+  std::string dir = (slash == std::string::npos) ? "." : (slash ? path.substr(0, slash) : "/");
+  std::string name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+  std::string base = name.substr(0, name.size() - strlen(".mjpeg"));
+  std::string aviPath = std::string(outDir ? outDir : dir.c_str()) + "/" + base + ".avi";
+  if (!replace && access(aviPath.c_str(), F_OK) == 0) return CONV_EXISTS;
+
+  uint32_t startUs = micros();
+  simSdRoot = dir.c_str();
+  if (!SD_MMC.begin()) return CONV_FAILED;
+  File fh = SD_MMC.open(("/" + name).c_str(), FILE_READ);
+  if (!fh || !isAVI(fh)) {
+    fprintf(stderr, "%s not convertible to AVI, eg no frame count in name\n", path.c_str());
+    return CONV_FAILED;
+  }
+  size_t aviSize = aviFileSize();
+  struct stat st;
+  result->inBytes = fh.size() + (stat((dir + "/" + base + ".wav").c_str(), &st) == 0 ? st.st_size : 0);
+  // write to temporary name so an interrupted conversion is not taken as done
+  std::string partPath = aviPath + ".part";
+  FILE* out = fopen(partPath.c_str(), "wb");
+  byte* clientBuf = (byte*)ps_malloc(CONV_BUFF_SIZE);
+  std::vector<char> outBuf(OUT_BUFF_SIZE);
+  bool ok = out && clientBuf;
+  if (out) setvbuf(out, outBuf.data(), _IOFBF, OUT_BUFF_SIZE);
+  segment segs[CONV_SEGS];
+  uint8_t segCnt;
+  // as ftp upload, any conversion left incomplete is reset by isAVI() for next recording
+  while (ok && (segCnt = readClientBuf(fh, clientBuf, CONV_BUFF_SIZE, segs, CONV_SEGS))) {
+    for (int i = 0; ok && i < segCnt; i++) {
+      ok = fwrite(segs[i].data, 1, segs[i].len, out) == segs[i].len;
+      result->outBytes += segs[i].len;
+    }
+  }
+  fh.close();
+  free(clientBuf);
+  if (out && fclose(out)) ok = false;
+  if (ok && result->outBytes != aviSize) {
+    fprintf(stderr, "%s converted to %llu bytes, expected %zu\n", path.c_str(), (unsigned long long)result->outBytes, aviSize);
+    ok = false;
+  }
+  if (ok) ok = rename(partPath.c_str(), aviPath.c_str()) == 0;
+  if (!ok) {
+    fprintf(stderr, "Failed to convert %s to %s\n", path.c_str(), aviPath.c_str());
+    unlink(partPath.c_str());
+    return CONV_FAILED;
+  }
+  result->usecs = micros() - startUs;
+  return CONV_DONE;
+}
+
+static void convertWorker(convPool* pool, const std::vector<std::string>& files, const char* outDir, bool replace) {
+  // convert recordings until none left
+  uint32_t i;
+  while ((i = pool->next++) < files.size())
+    pool->results[i].status = convertFile(files[i], outDir, replace, &pool->results[i]);
+}
+
+int main(int argc, char** argv) {
+  int workers = sysconf(_SC_NPROCESSORS_ONLN);
+  const char* outDir = NULL;
+  bool replace = false;
+  int opt;
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  while ((opt = getopt(argc, argv, "j:o:fv")) != -1) {
+    switch (opt) {
+      case 'j': workers = atoi(optarg); break;
+      case 'o': outDir = optarg; break;
+      case 'f': replace = true; break;
+      case 'v': debug = true; break; // no progress dots, as for verbose ESP32
+      default: usage(argv[0]); return 1;
+    }
+  }
+  if (optind >= argc || workers < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  std::vector<std::string> files;
+  for (int i = optind; i < argc; i++) findRecordings(argv[i], files);
+  if (files.empty()) {
+    printf("No mjpeg recordings found\n");
+    return 1;
+  }
+  workers = std::min(workers, (int)files.size());
+  simMmapRead = true;
+
+  size_t poolLen = sizeof(convPool) + files.size() * sizeof(convResult);
+  convPool* pool = (convPool*)mmap(NULL, poolLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (pool == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+  unsigned long startUs = micros();
+  for (int w = 0; w < workers; w++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("fork");
+      break;
+    }
+    if (!pid) {
+      // worker, conversion output of avi.cpp only shown if verbose, errors are on stderr
+      if (!debug) freopen("/dev/null", "w", stdout);
+      convertWorker(pool, files, outDir, replace);
+      _exit(0);
+    }
+  }
+  while (wait(NULL) > 0);
+  float secs = (micros() - startUs) / 1000000.0;
+
+  uint32_t counts[4] = {0};
+  uint64_t inBytes = 0, outBytes = 0, convUs = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    convResult* r = &pool->results[i];
+    counts[r->status]++;
+    if (r->status != CONV_DONE) continue;
+    inBytes += r->inBytes;
+    outBytes += r->outBytes;
+    convUs += r->usecs;
+    if (debug) printf("%s: %0.1f MB in %0.1f ms, %0.1f MB/s\n", files[i].c_str(), (float)r->inBytes / ONEMEG,
+      r->usecs / 1000.0, (double)r->inBytes / ONEMEG * 1000000 / std::max(r->usecs, (uint32_t)1));
+  }
+  printf("Converted %u of %u recordings, %u skipped as AVI exists, %u failed, %u not run\n", counts[CONV_DONE],
+    (uint32_t)files.size(), counts[CONV_EXISTS], counts[CONV_FAILED], counts[CONV_PENDING]);
+  printf("Read %0.1f MB, wrote %0.1f MB in %0.2f secs with %d workers, %0.1f MB/s, %0.1f MB/s per worker\n",
+    (float)inBytes / ONEMEG, (float)outBytes / ONEMEG, secs, workers, inBytes / ONEMEG / std::max(secs, 0.001f),
+    convUs ? (double)inBytes / convUs * 1000000 / ONEMEG : 0.0);
+  munmap(pool, poolLen);
+  return (counts[CONV_FAILED] || counts[CONV_PENDING]) ? 1 : 0;
+}
@@ -0,0 +1,251 @@
+/*
+ Host implementation of the arduino-esp32 core stand-ins in stubs/Arduino.h
+*/
+
+#include "Arduino.h"
+#include "esp_timer.h"
+#include <pthread.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+#define PSRAM_SIZE (4*1024*1024)
+#define HEAP_SIZE (320*1024)
+
+HardwareSerial Serial;
+EspClass ESP;
+
+static const std::chrono::steady_clock::time_point bootTime = std::chrono::steady_clock::now();
+
+static inline int64_t elapsedMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - bootTime).count();
+}
+
+unsigned long millis() {
+  return (unsigned long)(elapsedMicros() / 1000);
+}
+
+unsigned long micros() {
+  return (unsigned long)elapsedMicros();
+}
+
+int64_t esp_timer_get_time() {
+  return elapsedMicros();
+}
+
+void delay(uint32_t ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(uint32_t us) {
+  std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+/*************************** GPIO *****************************/
+
+static uint8_t pinLevel[40];
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin < sizeof(pinLevel)) pinLevel[pin] = (mode == INPUT_PULLUP) ? HIGH : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  if (pin < sizeof(pinLevel)) pinLevel[pin] = val;
+}
+
+int digitalRead(uint8_t pin) {
+  return (pin < sizeof(pinLevel)) ? pinLevel[pin] : LOW;
+}
+
+/*************************** memory *****************************/
+
+bool psramFound() {
+  return true;
+}
+
+// allocations are tracked so free pSRAM can be reported, which needs the
+// linker to route free() through __wrap_free (-Wl,--wrap=free)
+static std::mutex psramLock;
+static std::unordered_map<void*, size_t>* psramAllocs = NULL;
+static size_t psramUsed = 0;
+
+void* ps_malloc(size_t size) {
+  void* p = malloc(size);
+  if (p) {
+    std::lock_guard<std::mutex> lk(psramLock);
+    if (!psramAllocs) psramAllocs = new std::unordered_map<void*, size_t>();
+    (*psramAllocs)[p] = size;
+    psramUsed += size;
+  }
+  return p;
+}
+
+extern "C" void __real_free(void* p);
+extern "C" void __wrap_free(void* p) {
+  if (p) {
+    std::lock_guard<std::mutex> lk(psramLock);
+    if (psramAllocs) {
+      auto it = psramAllocs->find(p);
+      if (it != psramAllocs->end()) {
+        psramUsed -= it->second;
+        psramAllocs->erase(it);
+      }
+    }
+  }
+  __real_free(p);
+}
+
+uint32_t EspClass::getFreeHeap() {
+  // internal heap is not separated from psram on host, so report a nominal value
+  return HEAP_SIZE/2;
+}
+
+uint32_t EspClass::getFreePsram() {
+  std::lock_guard<std::mutex> lk(psramLock);
+  return (psramUsed < PSRAM_SIZE) ? PSRAM_SIZE - psramUsed : 0;
+}
+
+void EspClass::restart() {
+  fflush(stdout);
+  printf("ESP.restart() called, exiting simulation\n");
+  exit(1);
+}
+
+/*************************** time *****************************/
+
+void configTime(long, int, const char*, const char*, const char*) {
+  // host clock is assumed to already be synchronised
+}
+
+bool getLocalTime(struct tm* info, uint32_t) {
+  time_t now = time(NULL);
+  localtime_r(&now, info);
+  return true;
+}
+
+/*************************** Serial *****************************/
+
+size_t HardwareSerial::printf(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  int len = vprintf(format, args);
+  va_end(args);
+  return (len > 0) ? len : 0;
+}
+
+size_t HardwareSerial::print(const struct tm* timeinfo, const char* format) {
+  char buf[64];
+  size_t len = strftime(buf, sizeof(buf), format ? format : "%c", timeinfo);
+  return print(buf) ? len : 0;
+}
+
+/*************************** timers *****************************/
+
+#define APB_CLK_FREQ 80000000
+#define NUM_TIMERS 4
+
+struct hw_timer_s {
+  uint8_t num;
+  uint16_t divider;
+  uint64_t alarmValue;
+  bool autoreload;
+  bool enabled;
+  void (*isr)(void);
+  std::thread* thread;
+  std::mutex lock;
+  std::condition_variable changed;
+  uint32_t generation; // incremented on each change, restarts the period
+};
+
+static hw_timer_t timers[NUM_TIMERS];
+
+static void timerThread(hw_timer_t* timer) {
+  std::unique_lock<std::mutex> lk(timer->lock);
+  while (timer->thread) {
+    if (!timer->enabled || !timer->alarmValue) {
+      timer->changed.wait(lk);
+      continue;
+    }
+    uint32_t generation = timer->generation;
+    auto period = std::chrono::nanoseconds(timer->alarmValue * timer->divider * 1000 / (APB_CLK_FREQ / 1000000));
+    auto nextAlarm = std::chrono::steady_clock::now() + period;
+    while (timer->thread && timer->enabled && generation == timer->generation) {
+      if (timer->changed.wait_until(lk, nextAlarm) == std::cv_status::timeout) {
+        void (*isr)(void) = timer->isr;
+        lk.unlock();
+        if (isr) isr();
+        lk.lock();
+        if (!timer->autoreload) timer->enabled = false;
+        nextAlarm += period;
+      }
+    }
+  }
+}
+
+hw_timer_t* timerBegin(uint8_t num, uint16_t divider, bool) {
+  // as on the esp32, timers are a fixed set that are reused
+  if (num >= NUM_TIMERS) return NULL;
+  hw_timer_t* timer = &timers[num];
+  timerEnd(timer);
+  std::lock_guard<std::mutex> lk(timer->lock);
+  timer->num = num;
+  timer->divider = divider;
+  timer->alarmValue = 0;
+  timer->enabled = false;
+  timer->isr = NULL;
+  timer->generation++;
+  timer->thread = new std::thread(timerThread, timer);
+  return timer;
+}
+
+void timerEnd(hw_timer_t* timer) {
+  std::thread* thread;
+  {
+    std::lock_guard<std::mutex> lk(timer->lock);
+    thread = timer->thread;
+    timer->thread = NULL;
+    timer->enabled = false;
+    timer->isr = NULL;
+    timer->changed.notify_all();
+  }
+  if (thread) {
+    if (thread->get_id() == std::this_thread::get_id()) thread->detach();
+    else thread->join();
+    delete thread;
+  }
+}
+
+static void timerUpdate(hw_timer_t* timer, bool enable) {
+  std::lock_guard<std::mutex> lk(timer->lock);
+  timer->enabled = enable;
+  timer->generation++;
+  timer->changed.notify_all();
+}
+
+void timerAttachInterrupt(hw_timer_t* timer, void (*fn)(void), bool) {
+  std::lock_guard<std::mutex> lk(timer->lock);
+  timer->isr = fn;
+}
+
+void timerDetachInterrupt(hw_timer_t* timer) {
+  std::lock_guard<std::mutex> lk(timer->lock);
+  timer->isr = NULL;
+}
+
+void timerAlarmWrite(hw_timer_t* timer, uint64_t alarmValue, bool autoreload) {
+  std::lock_guard<std::mutex> lk(timer->lock);
+  timer->alarmValue = alarmValue;
+  timer->autoreload = autoreload;
+  timer->generation++;
+  timer->changed.notify_all();
+}
+
+void timerAlarmEnable(hw_timer_t* timer) {
+  timerUpdate(timer, true);
+}
+
+void timerAlarmDisable(hw_timer_t* timer) {
+  timerUpdate(timer, false);
+}
@@ -0,0 +1,334 @@
+/*
+ Host implementation of the esp32-camera stand-ins in stubs/esp_camera.h,
+ stubs/esp_jpg_decode.h and stubs/img_converters.h, using libjpeg.
+
+ Frames are replayed in name order from a directory of JPEG files, looping at the end.
+ If no directory is given, synthetic frames of a moving block are generated
+ at the requested frame size so that motion detection triggers. Synthetic frames
+ are re-encoded in the background when the sensor quality is changed.
+ Frames are delivered at the camera rate: if a caller is late, the frames it
+ missed are skipped as the sensor would, and counted.
+*/
+
+#include "esp_camera.h"
+#include "esp_jpg_decode.h"
+#define boolean jpeg_boolean // libjpeg boolean is int, Arduino is bool
+#include <jpeglib.h>
+#undef boolean
+#include <dirent.h>
+#include <sys/time.h>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <memory>
+
+#define SYNTH_FRAMES 50
+#define MAX_FB 4
+
+struct simFb {
+  camera_fb_t fb;
+  bool inUse;
+};
+
+typedef std::vector<std::vector<uint8_t>> frameSet;
+static std::shared_ptr<frameSet> frames; // replaced as a whole on quality change
+static bool synthetic = false;
+static uint32_t encodeSeq = 0; // latest quality change
+static simFb fbPool[MAX_FB];
+static int fbCount = 1;
+static float cameraFps = 0;
+static uint32_t frameSeq = 0; // index of next frame slot in camera timeline
+static uint32_t delivered = 0;
+static uint32_t skipped = 0;
+static unsigned long startMicros;
+static std::mutex camLock;
+static std::condition_variable fbReturned;
+static sensor_t sensor;
+
+static const uint16_t frameDims[][2] = {
+  {96, 96}, {160, 120}, {176, 144}, {240, 176}, {240, 240}, {320, 240}, {400, 296},
+  {480, 320}, {640, 480}, {800, 600}, {1024, 768}, {1280, 720}, {1280, 1024}, {1600, 1200}
+};
+
+static bool encodeJpeg(const uint8_t* src, int width, int height, int components,
+  int quality, uint8_t** out, size_t* outLen) {
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  unsigned long memLen = 0;
+  *out = NULL;
+  jpeg_mem_dest(&cinfo, out, &memLen);
+  cinfo.image_width = width;
+  cinfo.image_height = height;
+  cinfo.input_components = components;
+  cinfo.in_color_space = (components == 1) ? JCS_GRAYSCALE : JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW row = (JSAMPROW)(src + cinfo.next_scanline * width * components);
+    jpeg_write_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  *outLen = memLen;
+  return memLen > 0;
+}
+
+static int libjpegQuality(int quality) {
+  // OV2640 quality 10 (best used) to 63 mapped to libjpeg 90 to 10
+  return 90 - (std::min(std::max(quality, 10), 63) - 10) * 80 / 53;
+}
+
+static std::shared_ptr<frameSet> makeSyntheticFrames(framesize_t frameSize, int quality) {
+  // textured background with a bright block moving across the middle band
+  std::shared_ptr<frameSet> synth = std::make_shared<frameSet>();
+  int width = frameDims[frameSize][0];
+  int height = frameDims[frameSize][1];
+  std::vector<uint8_t> rgb(width * height * 3);
+  for (int f = 0; f < SYNTH_FRAMES; f++) {
+    int blockX = (width - width / 4) * f / (SYNTH_FRAMES - 1);
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++) {
+        uint8_t* p = &rgb[(y * width + x) * 3];
+        bool inBlock = x >= blockX && x < blockX + width / 4 && y > height / 3 && y < height * 2 / 3;
+        uint8_t bg = (uint8_t)(64 + ((x * 7 + y * 13) & 0x3F));
+        p[0] = inBlock ? 240 : bg;
+        p[1] = inBlock ? 220 : bg;
+        p[2] = inBlock ? 60 : bg;
+      }
+    }
+    uint8_t* jpg;
+    size_t jpgLen;
+    if (encodeJpeg(rgb.data(), width, height, 3, libjpegQuality(quality), &jpg, &jpgLen)) {
+      synth->push_back(std::vector<uint8_t>(jpg, jpg + jpgLen));
+      free(jpg);
+    }
+  }
+  return synth;
+}
+
+static bool loadFrames(const char* jpegDir) {
+  DIR* dir = opendir(jpegDir);
+  if (!dir) return false;
+  std::vector<std::string> names;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    std::string name(entry->d_name);
+    std::string ext = name.substr(name.find_last_of('.') + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+    if (ext == "jpg" || ext == "jpeg") names.push_back(name);
+  }
+  closedir(dir);
+  std::sort(names.begin(), names.end());
+  for (auto& name : names) {
+    std::string path = std::string(jpegDir) + "/" + name;
+    FILE* fp = fopen(path.c_str(), "rb");
+    if (!fp) continue;
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    std::vector<uint8_t> jpg(len);
+    if (fread(jpg.data(), 1, len, fp) == (size_t)len) frames->push_back(jpg);
+    fclose(fp);
+  }
+  return !frames->empty();
+}
+
+static bool jpegDimensions(const std::vector<uint8_t>& jpg, size_t* width, size_t* height) {
+  // scan markers for SOFn to get image size
+  size_t i = 2;
+  while (i + 9 < jpg.size()) {
+    if (jpg[i] != 0xFF) return false;
+    uint8_t marker = jpg[i+1];
+    size_t segLen = (jpg[i+2] << 8) | jpg[i+3];
+    if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+      *height = (jpg[i+5] << 8) | jpg[i+6];
+      *width = (jpg[i+7] << 8) | jpg[i+8];
+      return true;
+    }
+    i += 2 + segLen;
+  }
+  return false;
+}
+
+static int setFramesize(sensor_t* s, framesize_t framesize) {
+  s->status.framesize = framesize;
+  return 0;
+}
+
+static int setQuality(sensor_t* s, int quality) {
+  // replayed frames are not re-encoded, synthetic frames are re-encoded 
+  // in background, so new quality applies after a delay as on camera
+  s->status.quality = quality;
+  if (synthetic) {
+    std::lock_guard<std::mutex> lk(camLock);
+    uint32_t seq = ++encodeSeq;
+    framesize_t frameSize = s->status.framesize;
+    std::thread([seq, frameSize, quality]{
+      std::shared_ptr<frameSet> synth = makeSyntheticFrames(frameSize, quality);
+      std::lock_guard<std::mutex> lk(camLock);
+      if (seq == encodeSeq && !frames->empty()) frames = synth; // unless superseded
+    }).detach();
+  }
+  return 0;
+}
+
+static int setIgnored(sensor_t*, int) {
+  return 0;
+}
+
+bool simCameraInit(const char* jpegDir, float camFps, framesize_t frameSize, int fbCnt) {
+  frames = std::make_shared<frameSet>();
+  synthetic = !jpegDir;
+  if (jpegDir) {
+    if (!loadFrames(jpegDir)) {
+      fprintf(stderr, "No JPEG files found in %s\n", jpegDir);
+      return false;
+    }
+  } else frames = makeSyntheticFrames(frameSize, 10); // best quality, so largest frames
+  size_t maxLen = 0;
+  for (auto& jpg : *frames) maxLen = std::max(maxLen, jpg.size());
+  fbCount = std::min(std::max(fbCnt, 1), MAX_FB);
+  for (int i = 0; i < fbCount; i++) {
+    fbPool[i].fb.buf = (uint8_t*)malloc(maxLen);
+    fbPool[i].fb.format = PIXFORMAT_JPEG;
+    fbPool[i].inUse = false;
+  }
+  cameraFps = camFps;
+  frameSeq = delivered = skipped = 0;
+  startMicros = micros();
+  sensor.id.PID = OV2640_PID;
+  sensor.pixformat = PIXFORMAT_JPEG;
+  sensor.status.framesize = frameSize;
+  sensor.status.quality = 10;
+  sensor.set_framesize = setFramesize;
+  sensor.set_quality = setQuality;
+  sensor.set_brightness = sensor.set_contrast = sensor.set_saturation = setIgnored;
+  sensor.set_hmirror = sensor.set_vflip = setIgnored;
+  printf("Camera replaying %u %s frames at %0.1f fps with %d frame buffers\n",
+    (unsigned)frames->size(), jpegDir ? "JPEG" : "synthetic", camFps, fbCount);
+  return true;
+}
+
+void simCameraStats(uint32_t* _delivered, uint32_t* _skipped) {
+  std::lock_guard<std::mutex> lk(camLock);
+  *_delivered = delivered;
+  *_skipped = skipped;
+}
+
+camera_fb_t* esp_camera_fb_get() {
+  std::unique_lock<std::mutex> lk(camLock);
+  if (!frames || frames->empty()) return NULL;
+  // wait for free frame buffer, driver times out after 2 secs
+  // with a single frame buffer the driver captures into it on each call, returned or not
+  simFb* slot = (fbCount == 1) ? &fbPool[0] : NULL;
+  if (!slot) fbReturned.wait_for(lk, std::chrono::seconds(2), [&slot]{
+    for (int i = 0; i < fbCount; i++) if (!fbPool[i].inUse) slot = &fbPool[i];
+    return slot != NULL;
+  });
+  if (!slot) return NULL;
+  slot->inUse = true;
+  unsigned long due = 0;
+  if (cameraFps > 0) {
+    // next frame is either the next in sequence or the latest, if caller fell behind
+    uint32_t frameUs = (uint32_t)(1000000.0f / cameraFps);
+    uint32_t latest = (micros() - startMicros) / frameUs;
+    if (latest > frameSeq) {
+      skipped += latest - frameSeq;
+      frameSeq = latest;
+    }
+    due = startMicros + (unsigned long)frameSeq * frameUs;
+  }
+  std::shared_ptr<frameSet> current = frames; // kept while copied
+  const std::vector<uint8_t>& jpg = (*current)[frameSeq++ % current->size()];
+  delivered++;
+  lk.unlock();
+  long wait = (long)(due - micros());
+  if (due && wait > 0) std::this_thread::sleep_for(std::chrono::microseconds(wait));
+  // copy in as camera DMA would
+  memcpy(slot->fb.buf, jpg.data(), jpg.size());
+  slot->fb.len = jpg.size();
+  if (!jpegDimensions(jpg, &slot->fb.width, &slot->fb.height)) slot->fb.width = slot->fb.height = 0;
+  // capture time, being the frame slot time if paced, as wall clock time from gettimeofday() as 
+  // the camera driver does, so not on the millis() clock
+  static uint64_t bootUs = 0; // wall clock time of micros() zero
+  if (!bootUs) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    bootUs = (uint64_t)now.tv_sec * 1000000 + now.tv_usec - micros();
+  }
+  uint64_t captured = bootUs + (due ? due : micros());
+  slot->fb.timestamp.tv_sec = captured / 1000000;
+  slot->fb.timestamp.tv_usec = captured % 1000000;
+  return &slot->fb;
+}
+
+void esp_camera_fb_return(camera_fb_t* fb) {
+  std::lock_guard<std::mutex> lk(camLock);
+  for (int i = 0; i < fbCount; i++) if (&fbPool[i].fb == fb) fbPool[i].inUse = false;
+  fbReturned.notify_all();
+}
+
+sensor_t* esp_camera_sensor_get() {
+  return &sensor;
+}
+
+esp_err_t esp_camera_deinit() {
+  std::lock_guard<std::mutex> lk(camLock);
+  frames->clear();
+  return ESP_OK;
+}
+
+/*************************** image conversion *****************************/
+
+esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void* arg) {
+  std::vector<uint8_t> src(len);
+  if (reader(arg, 0, src.data(), len) != len) return ESP_FAIL;
+  struct jpeg_decompress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, src.data(), len);
+  if (jpeg_read_header(&cinfo, TRUE) != JPEG_HEADER_OK) {
+    jpeg_destroy_decompress(&cinfo);
+    return ESP_FAIL;
+  }
+  cinfo.out_color_space = JCS_RGB;
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = 1 << scale;
+  jpeg_start_decompress(&cinfo);
+  uint16_t width = cinfo.output_width;
+  uint16_t height = cinfo.output_height;
+  bool res = writer(arg, 0, 0, width, height, NULL); // start
+  // write in bands of 8 lines
+  const int band = 8;
+  std::vector<uint8_t> rgb(width * 3 * band);
+  while (res && cinfo.output_scanline < height) {
+    uint16_t y = cinfo.output_scanline;
+    int lines = 0;
+    while (lines < band && cinfo.output_scanline < height) {
+      JSAMPROW row = rgb.data() + lines * width * 3;
+      lines += jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+    res = writer(arg, 0, y, width, lines, rgb.data());
+  }
+  if (res) writer(arg, width, height, 0, 0, NULL); // end
+  jpeg_abort_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return res ? ESP_OK : ESP_FAIL;
+}
+
+bool fmt2jpg(uint8_t* src, size_t, uint16_t width, uint16_t height,
+  pixformat_t format, uint8_t quality, uint8_t** out, size_t* out_len) {
+  if (format == PIXFORMAT_GRAYSCALE) return encodeJpeg(src, width, height, 1, quality, out, out_len);
+  if (format != PIXFORMAT_RGB888) return false;
+  // esp32-camera RGB888 is stored BGR
+  std::vector<uint8_t> rgb(src, src + width * height * 3);
+  for (size_t i = 0; i < rgb.size(); i += 3) std::swap(rgb[i], rgb[i+2]);
+  return encodeJpeg(rgb.data(), width, height, 3, quality, out, out_len);
+}
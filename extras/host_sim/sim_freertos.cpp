@@ -0,0 +1,270 @@
+/*
+ Host implementation of the FreeRTOS stand-ins in stubs/freertos/FreeRTOS.h
+ Each task is a pthread with its own notification counter.
+ Priorities, stack sizes and core affinity are ignored.
+*/
+
+#include "Arduino.h"
+#include <pthread.h>
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+struct simTask {
+  pthread_t thread;
+  TaskFunction_t fn;
+  void* param;
+  char name[16];
+  std::mutex lock;
+  std::condition_variable notified;
+  uint32_t notifyCount;
+  bool deleted;
+};
+
+struct simSemaphore {
+  std::mutex lock;
+  std::condition_variable given;
+  UBaseType_t count;
+  UBaseType_t maxCount;
+};
+
+struct simQueue {
+  std::mutex lock;
+  std::condition_variable changed;
+  std::deque<std::vector<uint8_t>> items;
+  UBaseType_t length;
+  UBaseType_t itemSize;
+};
+
+static thread_local simTask* currentTask = NULL;
+static std::recursive_mutex criticalLock;
+
+void simEnterCritical() {
+  criticalLock.lock();
+}
+
+void simExitCritical() {
+  criticalLock.unlock();
+}
+
+template<typename Lock, typename Pred>
+static bool waitFor(std::condition_variable& cv, Lock& lk, TickType_t ticksToWait, Pred pred) {
+  // block for up to ticksToWait ms until pred satisfied
+  if (ticksToWait == portMAX_DELAY) {
+    cv.wait(lk, pred);
+    return true;
+  }
+  return cv.wait_for(lk, std::chrono::milliseconds(ticksToWait), pred);
+}
+
+static simTask* thisTask() {
+  // threads not started by xTaskCreate (eg main) get a task on first use
+  if (!currentTask) {
+    currentTask = new simTask();
+    currentTask->thread = pthread_self();
+    strcpy(currentTask->name, "main");
+  }
+  return currentTask;
+}
+
+/*************************** tasks *****************************/
+
+static void* taskEntry(void* arg) {
+  currentTask = (simTask*)arg;
+  currentTask->fn(currentTask->param);
+  // FreeRTOS tasks must not return
+  fprintf(stderr, "Task %s returned without vTaskDelete\n", currentTask->name);
+  return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t,
+  void* param, UBaseType_t, TaskHandle_t* handle) {
+  simTask* task = new simTask();
+  task->fn = fn;
+  task->param = param;
+  strncpy(task->name, name, sizeof(task->name)-1);
+  if (pthread_create(&task->thread, NULL, taskEntry, task) != 0) {
+    delete task;
+    return pdFAIL;
+  }
+  pthread_detach(task->thread);
+  if (handle) *handle = task;
+  return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stackDepth,
+  void* param, UBaseType_t priority, TaskHandle_t* handle, BaseType_t) {
+  return xTaskCreate(fn, name, stackDepth, param, priority, handle);
+}
+
+void vTaskDelete(TaskHandle_t handle) {
+  if (handle == NULL || handle == currentTask) pthread_exit(NULL);
+  else {
+    // another task is stopped at its next blocking call
+    std::lock_guard<std::mutex> lk(handle->lock);
+    handle->deleted = true;
+    handle->notified.notify_all();
+  }
+}
+
+void vTaskDelay(TickType_t ticks) {
+  delay(ticks);
+}
+
+TickType_t xTaskGetTickCount() {
+  return (TickType_t)millis();
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  return thisTask();
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t) {
+  return 1024; // not measured on host
+}
+
+/*************************** notifications *****************************/
+
+uint32_t ulTaskNotifyTake(BaseType_t clearOnExit, TickType_t ticksToWait) {
+  simTask* task = thisTask();
+  std::unique_lock<std::mutex> lk(task->lock);
+  waitFor(task->notified, lk, ticksToWait, [task]{ return task->notifyCount > 0 || task->deleted; });
+  if (task->deleted) {
+    lk.unlock();
+    pthread_exit(NULL);
+  }
+  uint32_t count = task->notifyCount;
+  if (count) task->notifyCount = clearOnExit ? 0 : count - 1;
+  return count;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t handle) {
+  if (handle) {
+    std::lock_guard<std::mutex> lk(handle->lock);
+    handle->notifyCount++;
+    handle->notified.notify_all();
+  }
+  return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t handle, BaseType_t* higherPriorityTaskWoken) {
+  xTaskNotifyGive(handle);
+  if (higherPriorityTaskWoken) *higherPriorityTaskWoken = pdTRUE;
+}
+
+/*************************** semaphores *****************************/
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount) {
+  simSemaphore* sem = new simSemaphore();
+  sem->maxCount = maxCount;
+  sem->count = initialCount;
+  return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  return xSemaphoreCreateCounting(1, 1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticksToWait) {
+  std::unique_lock<std::mutex> lk(sem->lock);
+  if (!waitFor(sem->given, lk, ticksToWait, [sem]{ return sem->count > 0; })) return pdFALSE;
+  sem->count--;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+  std::lock_guard<std::mutex> lk(sem->lock);
+  if (sem->count >= sem->maxCount) return pdFALSE;
+  sem->count++;
+  sem->given.notify_one();
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t* higherPriorityTaskWoken) {
+  BaseType_t res = xSemaphoreGive(sem);
+  if (higherPriorityTaskWoken && res) *higherPriorityTaskWoken = pdTRUE;
+  return res;
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t sem) {
+  std::lock_guard<std::mutex> lk(sem->lock);
+  return sem->count;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem) {
+  delete sem;
+}
+
+/*************************** queues *****************************/
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  simQueue* queue = new simQueue();
+  queue->length = length;
+  queue->itemSize = itemSize;
+  return queue;
+}
+
+static BaseType_t queueSend(QueueHandle_t queue, const void* item, TickType_t ticksToWait, bool toFront) {
+  std::unique_lock<std::mutex> lk(queue->lock);
+  if (!waitFor(queue->changed, lk, ticksToWait, [queue]{ return queue->items.size() < queue->length; }))
+    return errQUEUE_FULL;
+  std::vector<uint8_t> entry((const uint8_t*)item, (const uint8_t*)item + queue->itemSize);
+  if (toFront) queue->items.push_front(entry);
+  else queue->items.push_back(entry);
+  queue->changed.notify_all();
+  return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticksToWait) {
+  return queueSend(queue, item, ticksToWait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void* item, TickType_t ticksToWait) {
+  return queueSend(queue, item, ticksToWait, true);
+}
+
+static BaseType_t queueReceive(QueueHandle_t queue, void* buffer, TickType_t ticksToWait, bool remove) {
+  std::unique_lock<std::mutex> lk(queue->lock);
+  if (!waitFor(queue->changed, lk, ticksToWait, [queue]{ return !queue->items.empty(); })) return pdFALSE;
+  memcpy(buffer, queue->items.front().data(), queue->itemSize);
+  if (remove) {
+    queue->items.pop_front();
+    queue->changed.notify_all();
+  }
+  return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* buffer, TickType_t ticksToWait) {
+  return queueReceive(queue, buffer, ticksToWait, true);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void* buffer, TickType_t ticksToWait) {
+  return queueReceive(queue, buffer, ticksToWait, false);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> lk(queue->lock);
+  return queue->items.size();
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> lk(queue->lock);
+  return queue->length - queue->items.size();
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+  std::lock_guard<std::mutex> lk(queue->lock);
+  queue->items.clear();
+  queue->changed.notify_all();
+  return pdPASS;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+  delete queue;
+}
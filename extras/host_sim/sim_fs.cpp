@@ -0,0 +1,260 @@
+/*
+ Host implementation of the FS / SD_MMC stand-ins in stubs/FS.h and stubs/SD_MMC.h
+*/
+
+#include "SD_MMC.h"
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+const char* simSdRoot = "sdcard";
+uint32_t simCardMB = 4096;
+uint32_t simWriteUs = 0;
+uint32_t simStallMs = 0;
+bool simMmapRead = false;
+fs::SDMMCFS SD_MMC;
+
+namespace fs {
+
+struct FileImpl {
+  std::string path; // path from card root
+  std::string hostPath;
+  FILE* fp = NULL;
+  DIR* dir = NULL;
+  uint8_t* map = NULL; // content if memory mapped, when fp is NULL
+  size_t mapPos = 0;
+  size_t fileSize = 0; // tracked to avoid stat per call
+
+  ~FileImpl() { close(); }
+  void close() {
+    if (fp) fclose(fp);
+    if (dir) closedir(dir);
+    if (map) munmap(map, fileSize);
+    fp = NULL;
+    dir = NULL;
+    map = NULL;
+  }
+};
+
+static inline uint8_t* mapOf(const FileImplPtr& p) {
+  return p ? p->map : NULL;
+}
+
+static inline FILE* fileOf(const FileImplPtr& p) {
+  return p ? p->fp : NULL;
+}
+
+size_t File::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t File::write(const uint8_t* buf, size_t size) {
+  FILE* fp = fileOf(_p);
+  if (!fp) return 0;
+  size_t written = fwrite(buf, 1, size, fp);
+  static uint32_t writes = 0;
+  uint32_t delayUs = simWriteUs;
+  if (simStallMs && !(++writes % SIM_STALL_WRITES)) delayUs += simStallMs * 1000;
+  if (delayUs) delayMicroseconds(delayUs);
+  long pos = ftell(fp);
+  if (pos > (long)_p->fileSize) _p->fileSize = pos;
+  return written;
+}
+
+int File::available() {
+  if (mapOf(_p)) return (_p->mapPos < _p->fileSize) ? _p->fileSize - _p->mapPos : 0;
+  FILE* fp = fileOf(_p);
+  if (!fp) return 0;
+  long pos = ftell(fp);
+  return (pos < (long)_p->fileSize) ? _p->fileSize - pos : 0;
+}
+
+int File::read() {
+  uint8_t c;
+  return read(&c, 1) ? c : -1;
+}
+
+int File::peek() {
+  if (mapOf(_p)) return (_p->mapPos < _p->fileSize) ? _p->map[_p->mapPos] : -1;
+  FILE* fp = fileOf(_p);
+  if (!fp) return -1;
+  int c = fgetc(fp);
+  if (c != EOF) ungetc(c, fp);
+  return c;
+}
+
+void File::flush() {
+  FILE* fp = fileOf(_p);
+  if (fp) fflush(fp);
+}
+
+size_t File::read(uint8_t* buf, size_t size) {
+  if (mapOf(_p)) {
+    size_t len = (_p->mapPos < _p->fileSize) ? std::min(size, _p->fileSize - _p->mapPos) : 0;
+    memcpy(buf, _p->map + _p->mapPos, len);
+    _p->mapPos += len;
+    return len;
+  }
+  FILE* fp = fileOf(_p);
+  return fp ? fread(buf, 1, size, fp) : 0;
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+  if (mapOf(_p)) {
+    _p->mapPos = pos + ((mode == SeekCur) ? _p->mapPos : (mode == SeekEnd) ? _p->fileSize : 0);
+    return true;
+  }
+  FILE* fp = fileOf(_p);
+  int whence = (mode == SeekCur) ? SEEK_CUR : (mode == SeekEnd) ? SEEK_END : SEEK_SET;
+  return fp ? fseek(fp, pos, whence) == 0 : false;
+}
+
+size_t File::position() const {
+  if (mapOf(_p)) return _p->mapPos;
+  FILE* fp = fileOf(_p);
+  return fp ? ftell(fp) : 0;
+}
+
+size_t File::size() const {
+  return _p ? _p->fileSize : 0;
+}
+
+void File::close() {
+  if (_p) _p->close();
+  _p = NULL;
+}
+
+File::operator bool() const {
+  return _p && (_p->fp || _p->dir || _p->map);
+}
+
+time_t File::getLastWrite() {
+  struct stat st;
+  return (_p && stat(_p->hostPath.c_str(), &st) == 0) ? st.st_mtime : 0;
+}
+
+const char* File::name() const {
+  return _p ? _p->path.c_str() : NULL;
+}
+
+bool File::isDirectory() {
+  return _p && _p->dir;
+}
+
+File File::openNextFile(const char* mode) {
+  if (!_p || !_p->dir) return File();
+  struct dirent* entry;
+  while ((entry = readdir(_p->dir)) != NULL) {
+    if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, "..")) {
+      std::string path = _p->path;
+      if (path.empty() || path.back() != '/') path += "/";
+      return SD_MMC.open((path + entry->d_name).c_str(), mode);
+    }
+  }
+  return File();
+}
+
+void File::rewindDirectory() {
+  if (_p && _p->dir) rewinddir(_p->dir);
+}
+
+std::string FS::hostPath(const char* path) const {
+  std::string hpath = _root;
+  if (path[0] != '/') hpath += "/";
+  return hpath + path;
+}
+
+File FS::open(const char* path, const char* mode) {
+  FileImplPtr p = std::make_shared<FileImpl>();
+  p->path = path;
+  p->hostPath = hostPath(path);
+  struct stat st;
+  bool exists = stat(p->hostPath.c_str(), &st) == 0;
+  if (exists && S_ISDIR(st.st_mode)) p->dir = opendir(p->hostPath.c_str());
+  else if (simMmapRead && exists && st.st_size && !strcmp(mode, FILE_READ)) {
+    int fd = ::open(p->hostPath.c_str(), O_RDONLY);
+    void* map = (fd < 0) ? MAP_FAILED : mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (fd >= 0) ::close(fd);
+    if (map != MAP_FAILED) {
+      madvise(map, st.st_size, MADV_SEQUENTIAL);
+      p->map = (uint8_t*)map;
+      p->fileSize = st.st_size;
+    }
+  } else {
+    const char* hostMode = (!strcmp(mode, FILE_WRITE)) ? "wb" : (!strcmp(mode, FILE_APPEND)) ? "ab" : "rb";
+    p->fp = fopen(p->hostPath.c_str(), hostMode);
+    if (p->fp && exists && strcmp(mode, FILE_WRITE)) p->fileSize = st.st_size;
+  }
+  return (p->fp || p->dir || p->map) ? File(p) : File();
+}
+
+bool FS::exists(const char* path) {
+  struct stat st;
+  return stat(hostPath(path).c_str(), &st) == 0;
+}
+
+bool FS::remove(const char* path) {
+  return unlink(hostPath(path).c_str()) == 0;
+}
+
+bool FS::rename(const char* pathFrom, const char* pathTo) {
+  return ::rename(hostPath(pathFrom).c_str(), hostPath(pathTo).c_str()) == 0;
+}
+
+bool FS::mkdir(const char* path) {
+  return ::mkdir(hostPath(path).c_str(), 0755) == 0;
+}
+
+bool FS::rmdir(const char* path) {
+  return ::rmdir(hostPath(path).c_str()) == 0;
+}
+
+/*************************** SD_MMC *****************************/
+
+bool SDMMCFS::begin(const char*, bool) {
+  _root = simSdRoot;
+  ::mkdir(_root.c_str(), 0755);
+  struct stat st;
+  return stat(_root.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+void SDMMCFS::end() {
+  _root.clear();
+}
+
+sdcard_type_t SDMMCFS::cardType() {
+  return _root.empty() ? CARD_NONE : CARD_SDHC;
+}
+
+uint64_t SDMMCFS::cardSize() {
+  return (uint64_t)simCardMB * 1024 * 1024;
+}
+
+uint64_t SDMMCFS::totalBytes() {
+  return cardSize();
+}
+
+static uint64_t dirSize(const std::string& hpath) {
+  // total size of files below host path, standing in for FAT usage
+  uint64_t total = 0;
+  DIR* dir = opendir(hpath.c_str());
+  if (!dir) return 0;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..")) continue;
+    std::string epath = hpath + "/" + entry->d_name;
+    struct stat st;
+    if (stat(epath.c_str(), &st) != 0) continue;
+    total += S_ISDIR(st.st_mode) ? dirSize(epath) : st.st_size;
+  }
+  closedir(dir);
+  return total;
+}
+
+uint64_t SDMMCFS::usedBytes() {
+  return dirSize(_root);
+}
+
+} // namespace fs
@@ -0,0 +1,39 @@
+/*
+ Definitions the simulated files normally get from the rest of the sketch
+ (ESP32-CAM_MJPEG2SD.ino, myConfig.h, app_httpd.cpp, ftp.cpp, ds18b20.cpp).
+ Values are the sketch defaults.
+*/
+
+#include "Arduino.h"
+
+// myConfig.h
+char timezone[64] = "GMT0BST,M3.5.0/01,M10.5.0/02";
+uint8_t fsizePtr;
+uint8_t minSeconds = 5;
+uint16_t segmentSecs = 300;
+bool doRecording = true;
+uint8_t nightSwitch = 20;
+float motionVal = 8.0;
+bool autoQuality = false;
+uint8_t qualityMin = 10;
+uint8_t qualityMax = 30;
+bool lampVal = false;
+bool aviRecord = false;
+
+// app_httpd.cpp, must match
+#define PART_BOUNDARY "123456789000000000000987654321"
+const char* _STREAM_BOUNDARY = "\r\n--" PART_BOUNDARY "\r\n";
+const char* _STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %10u\r\n\r\n";
+
+// ds18b20.cpp
+TaskHandle_t getDS18tempHandle = NULL;
+
+// ESP32-CAM_MJPEG2SD.ino, framesize enum is the v1.0.5 one
+uint8_t fsizeLookup(uint8_t lookup, bool) {
+  return lookup;
+}
+
+// ftp.cpp
+void createUploadTask(const char* val, bool) {
+  printf("FTP upload of %s not simulated\n", val);
+}
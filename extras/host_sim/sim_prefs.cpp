@@ -0,0 +1,87 @@
+/*
+ Host implementation of the Preferences stand-in in stubs/Preferences.h
+*/
+
+#include "Preferences.h"
+#include <fstream>
+#include <sys/stat.h>
+
+const char* simPrefsDir = ".sim_prefs";
+
+bool Preferences::begin(const char* name, bool _readOnly) {
+  mkdir(simPrefsDir, 0755);
+  path = std::string(simPrefsDir) + "/" + name;
+  readOnly = _readOnly;
+  values.clear();
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    size_t eq = line.find('=');
+    if (eq != std::string::npos) values[line.substr(0, eq)] = line.substr(eq + 1);
+  }
+  started = true;
+  return true;
+}
+
+void Preferences::end() {
+  started = false;
+}
+
+void Preferences::save() {
+  if (!started || readOnly) return;
+  std::ofstream out(path, std::ios::trunc);
+  for (auto& kv : values) out << kv.first << "=" << kv.second << "\n";
+}
+
+bool Preferences::clear() {
+  if (!started || readOnly) return false;
+  values.clear();
+  save();
+  return true;
+}
+
+bool Preferences::remove(const char* key) {
+  if (!started || readOnly || !values.erase(key)) return false;
+  save();
+  return true;
+}
+
+bool Preferences::isKey(const char* key) {
+  return started && values.count(key);
+}
+
+size_t Preferences::putNum(const char* key, uint32_t value) {
+  if (!started || readOnly) return 0;
+  values[key] = std::to_string(value);
+  save();
+  return sizeof(value);
+}
+
+uint32_t Preferences::getNum(const char* key, uint32_t defaultValue) {
+  auto it = values.find(key);
+  return (started && it != values.end()) ? strtoul(it->second.c_str(), NULL, 10) : defaultValue;
+}
+
+size_t Preferences::putFloat(const char* key, float value) {
+  if (!started || readOnly) return 0;
+  values[key] = std::to_string(value);
+  save();
+  return sizeof(value);
+}
+
+float Preferences::getFloat(const char* key, float defaultValue) {
+  auto it = values.find(key);
+  return (started && it != values.end()) ? strtof(it->second.c_str(), NULL) : defaultValue;
+}
+
+size_t Preferences::putString(const char* key, const char* value) {
+  if (!started || readOnly) return 0;
+  values[key] = value;
+  save();
+  return strlen(value);
+}
+
+String Preferences::getString(const char* key, String defaultValue) {
+  auto it = values.find(key);
+  return (started && it != values.end()) ? String(it->second.c_str()) : defaultValue;
+}
@@ -0,0 +1,163 @@
+/*
+ Host stand-in for the arduino-esp32 core, just enough to compile
+ mjpeg2sd.cpp, avi.cpp and motionDetect.cpp unchanged on Linux.
+ Timing functions use the host monotonic clock, psram is ordinary heap.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+#include <time.h>
+#include <sys/time.h>
+#include <string>
+#include <algorithm>
+#include "freertos/FreeRTOS.h"
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define WORD_ALIGNED_ATTR __attribute__((aligned(4)))
+#define F(s) (s)
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0x01
+#define OUTPUT 0x02
+#define PULLUP 0x04
+#define INPUT_PULLUP 0x05
+#define PULLDOWN 0x08
+#define INPUT_PULLDOWN 0x09
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+// psram is emulated by the host heap, with usage tracked against a 4MB budget
+bool psramFound();
+void* ps_malloc(size_t size);
+
+// time
+void configTime(long gmtOffset_sec, int daylightOffset_sec, const char* server1,
+  const char* server2 = NULL, const char* server3 = NULL);
+bool getLocalTime(struct tm* info, uint32_t ms = 5000);
+
+/********************* hardware timers ************************/
+
+// 80MHz APB clock divided by prescaler, alarm runs isr on a host thread
+struct hw_timer_s;
+typedef struct hw_timer_s hw_timer_t;
+hw_timer_t* timerBegin(uint8_t num, uint16_t divider, bool countUp);
+void timerEnd(hw_timer_t* timer);
+void timerAttachInterrupt(hw_timer_t* timer, void (*fn)(void), bool edge);
+void timerDetachInterrupt(hw_timer_t* timer);
+void timerAlarmWrite(hw_timer_t* timer, uint64_t alarmValue, bool autoreload);
+void timerAlarmEnable(hw_timer_t* timer);
+void timerAlarmDisable(hw_timer_t* timer);
+
+/************************* String ****************************/
+
+class String {
+  public:
+    String(const char* s = "") : str(s ? s : "") {}
+    String(const std::string& s) : str(s) {}
+    String(char c) : str(1, c) {}
+    String(int val, unsigned char base = 10) { fromNum((long long)val, base); }
+    String(unsigned int val, unsigned char base = 10) { fromNum((long long)val, base); }
+    String(long val, unsigned char base = 10) { fromNum((long long)val, base); }
+    String(unsigned long val, unsigned char base = 10) { fromNum((long long)val, base); }
+    String(float val, unsigned char decimals = 2) { fromFloat(val, decimals); }
+    String(double val, unsigned char decimals = 2) { fromFloat(val, decimals); }
+
+    const char* c_str() const { return str.c_str(); }
+    unsigned int length() const { return str.length(); }
+    long toInt() const { return atol(str.c_str()); }
+    void toUpperCase() { for (auto& c : str) c = toupper(c); }
+    void toLowerCase() { for (auto& c : str) c = tolower(c); }
+    int indexOf(char c, unsigned int from = 0) const { return find(str.find(c, from)); }
+    int indexOf(const String& s, unsigned int from = 0) const { return find(str.find(s.str, from)); }
+    int lastIndexOf(char c) const { return find(str.rfind(c)); }
+    String substring(unsigned int from) const { return from < str.size() ? String(str.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const {
+      return from < str.size() && to > from ? String(str.substr(from, to - from)) : String();
+    }
+    bool startsWith(const String& s) const { return str.compare(0, s.str.size(), s.str) == 0; }
+    bool endsWith(const String& s) const {
+      return s.str.size() <= str.size() && str.compare(str.size() - s.str.size(), s.str.size(), s.str) == 0;
+    }
+    char operator[](unsigned int i) const { return i < str.size() ? str[i] : 0; }
+
+    String& operator+=(const String& s) { str += s.str; return *this; }
+    String& operator+=(const char* s) { str += s; return *this; }
+    String& operator+=(char c) { str += c; return *this; }
+    friend String operator+(const String& a, const String& b) { return String(a.str + b.str); }
+    friend String operator+(const String& a, const char* b) { return String(a.str + b); }
+    friend String operator+(const char* a, const String& b) { return String(a + b.str); }
+    bool operator==(const String& s) const { return str == s.str; }
+    bool operator==(const char* s) const { return str == s; }
+    bool operator!=(const String& s) const { return str != s.str; }
+    bool operator<(const String& s) const { return str < s.str; }
+    bool operator>(const String& s) const { return str > s.str; }
+
+  private:
+    std::string str;
+    static int find(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+    void fromNum(long long val, unsigned char base) {
+      char buf[72];
+      if (base == 16) snprintf(buf, sizeof(buf), "%llx", val);
+      else snprintf(buf, sizeof(buf), "%lld", val);
+      str = buf;
+    }
+    void fromFloat(double val, unsigned char decimals) {
+      char buf[64];
+      snprintf(buf, sizeof(buf), "%.*f", decimals, val);
+      str = buf;
+    }
+};
+
+/************************* Serial ****************************/
+
+class HardwareSerial {
+  public:
+    void begin(unsigned long) {}
+    void setDebugOutput(bool) {}
+    void flush() { fflush(stdout); }
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    size_t write(uint8_t c) { return fputc(c, stdout) == EOF ? 0 : 1; }
+    size_t write(const uint8_t* buf, size_t len) { return fwrite(buf, 1, len, stdout); }
+    size_t print(const char* s) { fputs(s, stdout); return strlen(s); }
+    size_t print(const String& s) { return print(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int val) { return printf("%d", val); }
+    size_t print(unsigned int val) { return printf("%u", val); }
+    size_t print(long val) { return printf("%ld", val); }
+    size_t print(unsigned long val) { return printf("%lu", val); }
+    size_t print(double val, int decimals = 2) { return printf("%.*f", decimals, val); }
+    size_t print(const struct tm* timeinfo, const char* format = NULL);
+    template<typename T> size_t println(T val) { size_t n = print(val); return n + println(); }
+    size_t println(const struct tm* timeinfo, const char* format = NULL) { return print(timeinfo, format) + println(); }
+    size_t println() { return print("\n"); }
+};
+extern HardwareSerial Serial;
+
+/*************************** ESP *****************************/
+
+class EspClass {
+  public:
+    uint32_t getFreeHeap();
+    uint32_t getFreePsram();
+    uint64_t getEfuseMac() { return 0x0000A1B2C3D4E5F6ULL; }
+    void restart();
+};
+extern EspClass ESP;
@@ -0,0 +1,79 @@
+/*
+ Host stand-in for the arduino-esp32 FS library.
+ Files are POSIX files below a host directory standing in for the SD card.
+ As with the v1.0.4 core, name() returns the full path from the card root.
+*/
+
+#pragma once
+
+#include "Arduino.h"
+#include <memory>
+
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+
+namespace fs {
+
+enum SeekMode {
+  SeekSet = 0,
+  SeekCur = 1,
+  SeekEnd = 2
+};
+
+struct FileImpl;
+typedef std::shared_ptr<FileImpl> FileImplPtr;
+
+class File {
+  public:
+    File(FileImplPtr p = FileImplPtr()) : _p(p) {}
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buf, size_t size);
+    int available();
+    int read();
+    int peek();
+    void flush();
+    size_t read(uint8_t* buf, size_t size);
+    bool seek(uint32_t pos, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    void close();
+    operator bool() const;
+    time_t getLastWrite();
+    const char* name() const;
+    bool isDirectory();
+    File openNextFile(const char* mode = FILE_READ);
+    void rewindDirectory();
+
+  protected:
+    FileImplPtr _p;
+};
+
+class FS {
+  public:
+    File open(const char* path, const char* mode = FILE_READ);
+    File open(const String& path, const char* mode = FILE_READ) { return open(path.c_str(), mode); }
+    bool exists(const char* path);
+    bool exists(const String& path) { return exists(path.c_str()); }
+    bool remove(const char* path);
+    bool remove(const String& path) { return remove(path.c_str()); }
+    bool rename(const char* pathFrom, const char* pathTo);
+    bool rename(const String& pathFrom, const String& pathTo) { return rename(pathFrom.c_str(), pathTo.c_str()); }
+    bool mkdir(const char* path);
+    bool mkdir(const String& path) { return mkdir(path.c_str()); }
+    bool rmdir(const char* path);
+    bool rmdir(const String& path) { return rmdir(path.c_str()); }
+
+  protected:
+    std::string hostPath(const char* path) const;
+    std::string _root;
+};
+
+} // namespace fs
+
+using fs::FS;
+using fs::File;
+using fs::SeekMode;
+using fs::SeekSet;
+using fs::SeekCur;
+using fs::SeekEnd;
@@ -0,0 +1,45 @@
+/*
+ Host stand-in for the arduino-esp32 Preferences (NVS) library.
+ Each namespace is kept as a key=value text file in simPrefsDir, so values
+ persist between runs as they would in flash.
+*/
+
+#pragma once
+
+#include "Arduino.h"
+#include <map>
+
+extern const char* simPrefsDir; // host directory for namespace files
+
+class Preferences {
+  public:
+    bool begin(const char* name, bool readOnly = false);
+    void end();
+    bool clear();
+    bool remove(const char* key);
+    bool isKey(const char* key);
+
+    size_t putUChar(const char* key, uint8_t value) { return putNum(key, value); }
+    size_t putUShort(const char* key, uint16_t value) { return putNum(key, value); }
+    size_t putUInt(const char* key, uint32_t value) { return putNum(key, value); }
+    size_t putBool(const char* key, bool value) { return putNum(key, value); }
+    size_t putFloat(const char* key, float value);
+    size_t putString(const char* key, const char* value);
+    size_t putString(const char* key, String value) { return putString(key, value.c_str()); }
+
+    uint8_t getUChar(const char* key, uint8_t defaultValue = 0) { return getNum(key, defaultValue); }
+    uint16_t getUShort(const char* key, uint16_t defaultValue = 0) { return getNum(key, defaultValue); }
+    uint32_t getUInt(const char* key, uint32_t defaultValue = 0) { return getNum(key, defaultValue); }
+    bool getBool(const char* key, bool defaultValue = false) { return getNum(key, defaultValue); }
+    float getFloat(const char* key, float defaultValue = NAN);
+    String getString(const char* key, String defaultValue = String());
+
+  private:
+    size_t putNum(const char* key, uint32_t value);
+    uint32_t getNum(const char* key, uint32_t defaultValue);
+    void save();
+    std::string path;
+    std::map<std::string, std::string> values;
+    bool started = false;
+    bool readOnly = false;
+};
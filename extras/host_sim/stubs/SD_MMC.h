@@ -0,0 +1,39 @@
+/*
+ Host stand-in for the arduino-esp32 SD_MMC library.
+ The card is a host directory (simSdRoot) with an emulated capacity (simCardMB).
+*/
+
+#pragma once
+
+#include "FS.h"
+
+typedef enum {
+  CARD_NONE,
+  CARD_MMC,
+  CARD_SD,
+  CARD_SDHC,
+  CARD_UNKNOWN
+} sdcard_type_t;
+
+extern const char* simSdRoot; // host directory used as card root
+extern uint32_t simCardMB; // emulated card capacity
+extern uint32_t simWriteUs; // emulated card latency per write call
+extern uint32_t simStallMs; // emulated card garbage collection stall every SIM_STALL_WRITES writes
+#define SIM_STALL_WRITES 64
+extern bool simMmapRead; // memory map files opened for read, for files not being written
+
+namespace fs {
+
+class SDMMCFS : public FS {
+  public:
+    bool begin(const char* mountpoint = "/sdcard", bool mode1bit = false);
+    void end();
+    sdcard_type_t cardType();
+    uint64_t cardSize();
+    uint64_t totalBytes();
+    uint64_t usedBytes();
+};
+
+} // namespace fs
+
+extern fs::SDMMCFS SD_MMC;
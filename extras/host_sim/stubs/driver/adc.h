@@ -0,0 +1,31 @@
+#pragma once
+
+// microphone input is not simulated, samples read as silence
+typedef enum {
+  ADC1_CHANNEL_0 = 0,
+  ADC1_CHANNEL_1,
+  ADC1_CHANNEL_2,
+  ADC1_CHANNEL_3,
+  ADC1_CHANNEL_4,
+  ADC1_CHANNEL_5,
+  ADC1_CHANNEL_6,
+  ADC1_CHANNEL_7,
+} adc1_channel_t;
+
+typedef enum {
+  ADC_WIDTH_BIT_9 = 0,
+  ADC_WIDTH_BIT_10,
+  ADC_WIDTH_BIT_11,
+  ADC_WIDTH_BIT_12,
+} adc_bits_width_t;
+
+typedef enum {
+  ADC_ATTEN_DB_0 = 0,
+  ADC_ATTEN_DB_2_5,
+  ADC_ATTEN_DB_6,
+  ADC_ATTEN_DB_11,
+} adc_atten_t;
+
+static inline int adc1_config_width(adc_bits_width_t) { return 0; }
+static inline int adc1_config_channel_atten(adc1_channel_t, adc_atten_t) { return 0; }
+static inline int adc1_get_raw(adc1_channel_t) { return 2048; }
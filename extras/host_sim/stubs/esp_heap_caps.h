@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdlib.h>
+
+// host heap stands in for internal, dma capable ram
+#define MALLOC_CAP_DMA (1<<3)
+#define MALLOC_CAP_8BIT (1<<2)
+#define MALLOC_CAP_INTERNAL (1<<11)
+#define MALLOC_CAP_SPIRAM (1<<10)
+
+inline void* heap_caps_malloc(size_t size, uint32_t) { return malloc(size); }
+inline size_t heap_caps_get_largest_free_block(uint32_t) { return 128 * 1024; }
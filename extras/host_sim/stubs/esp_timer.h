@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// microseconds since start, from the host monotonic clock
+int64_t esp_timer_get_time();
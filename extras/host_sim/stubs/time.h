@@ -0,0 +1,9 @@
+/*
+ The sketch declares its own char timezone[] (myConfig.h), which clashes with
+ the glibc long timezone variable. Hide the glibc one, keeping struct timezone.
+*/
+
+#include <sys/time.h>
+#define timezone __host_timezone
+#include_next <time.h>
+#undef timezone
@@ -21,8 +21,8 @@ extern char ftp_wd[];
 //FTP buffers
 char rspBuf[255]; //Ftp response buffer
 uint8_t rspCount;
-#define BUFF_EXT 100
-#define BUFF_SIZE (32 * 1024)+BUFF_EXT // Upload data buffer size
+#define BUFF_SIZE (32 * 1024) // Minimum upload data buffer size
+#define UPLOAD_SEGS 32 // segments of upload data per buffer
 #define RESPONSE_TIMEOUT 10000                             
 unsigned int hiPort; //Data connection port
 static File root;
@@ -30,11 +30,19 @@ static File root;
 WiFiClient client;
 WiFiClient dclient;
 
-extern bool doPlayback;
+extern size_t sdBlockSize;
 extern bool stopCheck;
+extern SemaphoreHandle_t aviMutex;
+struct segment {
+  const uint8_t* data;
+  size_t len;
+}; // as in mjpeg2sd.cpp
 bool isAVI(File &fh);
-size_t readClientBuf(File &fh, byte* &clientBuf, size_t buffSize);
+void endAVI();
+uint8_t readClientBuf(File &fh, byte* clientBuf, size_t buffSize, segment* segs, uint8_t maxSegs);
 size_t isSubArray(uint8_t* haystack, uint8_t* needle, size_t hSize, size_t nSize);
+void stopPlaying();
+void thumbName(char* thumb, const char* mjpegName, size_t thumbLen);
 
 void efail(){
   byte thisByte = 0;
@@ -193,6 +201,7 @@ bool ftpStoreFile(String file, File &fh){
   
   // determine if file is suitable for conversion to AVI
   std::string sfile(file.c_str());
+  xSemaphoreTake(aviMutex, portMAX_DELAY); // wait for any http AVI download to finish
   if (isAVI(fh)) {
     sfile = std::regex_replace(sfile, std::regex("mjpeg"), "avi");
     file = String(sfile.data());
@@ -206,21 +215,28 @@ bool ftpStoreFile(String file, File &fh){
     ESP_LOGI(TAG, "Ftp data connected");
   } else{
     ESP_LOGE(TAG, "Ftp data connection failed");   
+    endAVI();
+    xSemaphoreGive(aviMutex);
    return 0;
   }
   client.print("STOR ");
   client.println(file);
   if (!eRcv()){
     dclient.stop();
+    endAVI();
+    xSemaphoreGive(aviMutex);
     return 0;
   }
   
   ESP_LOGI(TAG, "Uploading..");
   //byte clientBuf[BUFF_SIZE];
-  byte *clientBuf = (byte*)ps_malloc(BUFF_SIZE * sizeof(byte)); 
+  size_t buffSize = std::max(sdBlockSize, (size_t)BUFF_SIZE); // multiple of SD read size
+  byte *clientBuf = (byte*)ps_malloc(buffSize * sizeof(byte)); 
   if(clientBuf==NULL){
     ESP_LOGE(TAG, "Memory allocation failed ..");
     dclient.stop();
+    endAVI();
+    xSemaphoreGive(aviMutex);
     return 0;
   }
   
@@ -228,12 +244,23 @@ bool ftpStoreFile(String file, File &fh){
   uint32_t writeBytes=0;                       
   unsigned long uploadStart = millis();
   size_t readLen, writeLen = 0;
+  segment segs[UPLOAD_SEGS];
   do {
-    readLen = readClientBuf(fh, clientBuf, BUFF_SIZE-BUFF_EXT); // obtain modified data to send 
-    if(readLen) writeLen = dclient.write((const uint8_t *)clientBuf, readLen);
-    if(readLen>0 && writeLen==0){
+    // obtain modified data to send, as segments of buffer and generated headers
+    uint8_t segCnt = readClientBuf(fh, clientBuf, buffSize, segs, UPLOAD_SEGS); 
+    readLen = writeLen = 0;
+    for (int i = 0; i < segCnt; i++) {
+      readLen += segs[i].len;
+      size_t sent = dclient.write(segs[i].data, segs[i].len);
+      writeLen += sent;
+      if (sent < segs[i].len) break;
+    }
+    if(readLen>0 && writeLen<readLen){
         ESP_LOGE(TAG, "Write buffer failed ..");
         dclient.stop();
+        free(clientBuf);
+        endAVI();
+        xSemaphoreGive(aviMutex);
         return 0;
     }
     writeBytes += writeLen;
@@ -242,11 +269,13 @@ bool ftpStoreFile(String file, File &fh){
     }
     ++buffCount;
   } while (readLen);
-  if(readLen<BUFF_SIZE) ESP_LOGI(TAG, "Uploaded 100%%");
+  if(readLen<buffSize) ESP_LOGI(TAG, "Uploaded 100%%");
   float uploadDur =  (millis() - uploadStart)/1024;  
   free(clientBuf);
   ESP_LOGI(TAG, "Done Uploaded in %3.1f sec",uploadDur); 
   dclient.stop();
+  endAVI();
+  xSemaphoreGive(aviMutex);
   return 1; 
 }
 
@@ -289,6 +318,11 @@ void uploadFolderOrFileFtp(String sdName, const bool removeAfterUpload, uint8_t
       if(removeAfterUpload){
         ESP_LOGI(TAG, "Removing file %s", sdName.c_str()); 
         SD_MMC.remove(sdName.c_str());
+        if (sdName.endsWith(".mjpeg") || sdName.endsWith(".avi")) {
+          char thumb[100];
+          thumbName(thumb, sdName.c_str(), sizeof(thumb));
+          SD_MMC.remove(thumb);
+        }
       }    
   }else{  //Upload a whole directory
       ESP_LOGI(TAG, "Uploading directory: %s", sdName.c_str()); 
@@ -315,7 +349,8 @@ void uploadFolderOrFileFtp(String sdName, const bool removeAfterUpload, uint8_t
               }*/
           } else { 
               byte bPos = sdName.lastIndexOf(".");
-              if (sdName.substring(bPos+1) == "mjpeg") {
+              String ext = sdName.substring(bPos+1);
+              if (ext == "mjpeg" || ext == "avi") {
                 bPos = sdName.lastIndexOf("/");
                 String ftpName = sdName.substring(bPos+1);      
                 ESP_LOGI(TAG, "Uploading sub sd file %s to %s", sdName.c_str(),ftpName.c_str()); 
@@ -355,7 +390,7 @@ void createUploadTask(const char* val, bool move=false){
     else {
       stopCheck = true; // prevent ram space contention
       delay(100);
-      doPlayback = false;
+      stopPlaying();
       static char fname[100];
       strcpy(fname, val); // else wont persist
       removeAfterUpload = move;
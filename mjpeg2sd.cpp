@@ -13,8 +13,40 @@ extern char timezone[]; // Defined in myConfig.h
 #define USE_MOTION true // whether to use camera for motion detection (with motionDetect.cpp)
 #define MOVE_START_CHECKS 5 // checks per second for start
 #define MOVE_STOP_SECS 1 // secs between each check for stop
-#define RAMSIZE 8192 // set this to multiple of SD card sector size (512 or 1024 bytes)
-#define MAX_FRAMES 20000 // maximum number of frames in video before auto close
+#define RAMSIZE 8192 // default SD read / write size, set this to multiple of SD card sector size (512 or 1024 bytes)
+#define SD_CALIBRATE true // at startup, find fastest SD write size for a new card, between RAMSIZE and MAX_SD_BLOCK
+#define MAX_SD_BLOCK 32768 // largest SD write size tried, needs this much internal ram, eg 65536 if heap allows
+#define CALIB_BYTES (ONEMEG/2) // bytes written to SD for each size tried
+#define MAX_FRAMES 20000 // maximum number of frames in video before continuing in next segment
+#define MAX_SEG_SIZE (4000UL * ONEMEG) // maximum size of segment file before continuing in next, under FAT32 4GB limit
+#define PREOPEN_SECS 10 // secs before end of segment when next segment file is opened
+#define FRAME_QUEUE_SIZE ONEMEG // psram buffer for jpegs copied from camera waiting to be stored by writerTask, power of 2
+#define FRAME_QUEUE_LEN 64 // maximum number of frames waiting in frame queue
+#define FB_SPARE 2 // camera frame buffers kept free for capture and streaming, any others can be held in frame queue instead of copied
+#define QUEUE_WAIT 0 // ms captureTask waits for space in full frame queue before dropping frame, 0 drops immediately, portMAX_DELAY never drops
+#define PRE_ROLL_SECS 2 // secs of frames prior to motion being confirmed to include in recording, 0 for none
+#define PRE_ROLL_SIZE (ONEMEG/2) // max bytes of frame queue used by copied pre-roll frames, less than FRAME_QUEUE_SIZE
+#define PRE_ROLL_FRAMES 48 // max number of pre-roll frames, less than FRAME_QUEUE_LEN
+#define READ_AHEAD 8 // SD blocks in each playback session's read ahead ring, filled in advance by playbackTask
+#define PLAYBACK_PSRAM (ONEMEG/2) // psram for playback session rings, each of READ_AHEAD SD blocks, limits concurrent playbacks
+#define MAX_SESSIONS 4 // max concurrent playback sessions, one per browser tab
+#define TAIL_BUFF (ONEMEG/4) // psram copy of recording content not yet synced to SD, for live tail playback
+#define TAIL_WAIT 20 // ms live tail playback waits for more content once caught up with recording
+#define MIN_SPEED 25 // slowest playback speed, as % of recorded rate
+#define MAX_SPEED 800 // fastest playback speed, as % of recorded rate
+#define MAX_STEP 64 // largest fast forward step, sending one frame in MAX_STEP
+#define MAX_CATCHUP 5 // max late frame timer ticks processed by captureTask, excess ticks are skipped
+#define FRAME_INDEX true // append frame index trailer to each recording, so readers can seek to any frame
+#define THUMBNAIL true // save downscaled jpeg of highest motion frame alongside each recording
+#define THUMB_WIDTH 100 // min thumbnail width, frame is downscaled by largest of 1/2, 1/4, 1/8 that gives this
+#define THUMB_QUALITY 80 // thumbnail jpeg quality, 0 to 100
+#define THUMB_QUEUE_LEN 4 // closed segments waiting for thumbTask to save thumbnail
+#define QUALITY_SECS 1 // secs between each jpeg quality adjustment when autoQuality on
+#define SD_LOAD_HIGH 80 // % of SD bandwidth needed at target FPS above which jpeg quality is reduced
+#define SD_LOAD_LOW 50 // % of SD bandwidth needed at target FPS below which jpeg quality is increased
+#define QUALITY_LOG 32 // max number of quality changes listed in recording stats
+#define LAT_SUB_BITS 2 // latency histogram buckets per power of 2 is 2^LAT_SUB_BITS
+#define LAT_BUCKETS 96 // latency histogram buckets, covers up to 16 secs
 #define ONELINE true // MMC 1 line mode
 #define minCardFreeSpace 50 // Minimum amount of card free Megabytes before freeSpaceMode action is enabled
 #define freeSpaceMode 1 // 0 - No Check, 1 - Delete oldest dir, 2 - Move to ftp and then delete folder                                                                                                               
@@ -22,9 +54,12 @@ extern char timezone[]; // Defined in myConfig.h
 
 #include <SD_MMC.h>
 #include <regex>
+#include <inttypes.h>
 #include <sys/time.h> 
 #include "time.h"
 #include "esp_camera.h"
+#include "esp_heap_caps.h"
+#include <Preferences.h>
 
 // user parameters
 bool debug = false;
@@ -33,6 +68,11 @@ extern bool doRecording;// = true; // whether to capture to SD or not
 extern uint8_t minSeconds;// = 5; // default min video length (includes POST_MOTION_TIME)
 extern uint8_t nightSwitch;// = 20; // initial white level % for night/day switching
 extern float motionVal;// = 8.0; // initial motion sensitivity setting 
+extern bool autoQuality; // adjust jpeg quality during recording to sustain FPS
+extern uint8_t qualityMin; // best jpeg quality autoQuality can use (lower value is better quality)
+extern uint8_t qualityMax; // worst jpeg quality autoQuality can use
+extern uint16_t segmentSecs; // secs of recording per segment file, 0 for MAX_FRAMES only
+extern bool aviRecord; // record as AVI instead of MJPEG, so recordings are uploaded and downloaded without conversion
 bool timeSynchronized = false;
 // status & control fields
 uint8_t FPS;
@@ -45,6 +85,7 @@ uint16_t insufficient = 0;
 extern const char* _STREAM_BOUNDARY; 
 extern const char* _STREAM_PART;
 static const size_t streamBoundaryLen = strlen(_STREAM_BOUNDARY);
+static const size_t frameHdrLen = streamBoundaryLen + strlen(_STREAM_PART) + 6; // boundary and part header before each jpeg, as Content-Length is 10 digits
 #define PART_BUF_LEN 64
 static char* part_buf[PART_BUF_LEN];
 
@@ -53,11 +94,12 @@ static uint32_t vidSize; // total video size
 static uint16_t frameCnt;
 static uint32_t startMjpeg; // total overall time
 static uint32_t dTimeTot; // total frame decode/monitor time
-static uint32_t fTimeTot; // total frame buffering time
+static uint32_t qTimeTot; // total frame queueing time in us
+static uint32_t bTimeTot; // total SD block assembly time in us
 static uint32_t wTimeTot; // total SD write time
+static uint64_t wUsTot; // total SD write time in us while recording
 static uint32_t oTime; // file opening time
 static uint32_t cTime; // file closing time 
-static uint32_t sTime; // file streaming time
 static uint32_t vidDuration; // duration in secs of recorded file
 
 struct frameStruct {
@@ -95,38 +137,279 @@ static uint16_t frameInterval; // units of 0.1ms between frames
 #define ONEMEG (1024*1024)
 #define MAX_JPEG ONEMEG/2 // UXGA jpeg frame buffer at highest quality 375kB rounded up
 #define MJPEGEXT "mjpeg"
-uint8_t* SDbuffer; // has to be dynamically allocated due to size
-uint8_t iSDbuffer[RAMSIZE];
+#define AVIEXT "avi"
+#define THUMBEXT "jpg"
+#define AVI_HDR_LEN 1122 // OpenDML AVI header before first frame, as ODML_HEADER_LEN in avi.cpp
+#define AVI_CHUNK_HDR 8 // AVI chunk header before each jpeg
+#define AVI_RIFF_MAX (1000*ONEMEG) // AVI continues in an OpenDML AVIX RIFF beyond this, so first RIFF plays on AVI 1.0 players
+#define AVI_IX_FRAMES 1250 // frames per OpenDML standard index chunk, so MAX_FRAMES needs 16 super index entries
+#define AVI_SUPER_ENTRIES 32 // OpenDML super index entries, as SUPER_ENTRIES in avi.cpp
+#define AVI_MAX_RIFFS 8 // AVIX RIFFs per file, FAT32 4GB file needs 4
+#define AVI_IDX_FILE "/aviIdx.tmp" // scratch file for AVI index spilled by conversion, as in avi.cpp
+static uint8_t* queueBuffer; // frame queue ring buffer, has to be dynamically allocated due to size
+uint8_t* iSDbuffer = NULL; // internal ram block for SD transfers, dma capable
+size_t sdBlockSize = RAMSIZE; // SD read / write size, calibrated for card
 char* htmlBuff;
 static size_t htmlBuffLen = 20000; // set big enough to hold all file names in a folder
-static size_t highPoint;
 static File mjpegFile;
 static char mjpegName[100];
+static bool recAvi = false; // current recording stored as AVI, from aviRecord at its start
+static uint8_t aviHdr[AVI_HDR_LEN]; // AVI header of current file, written first then rewritten when file finished
+struct odmlState {
+  // OpenDML layout of AVI file being written, with index chunks written as recording progresses
+  uint8_t superIndex[AVI_SUPER_ENTRIES * 16]; // super index entries of standard index chunks written
+  uint8_t superCnt;
+  uint32_t ixStart; // first frame in frameIndex not yet in a standard index chunk
+  uint32_t riffStart; // position of current RIFF
+  uint32_t riffPos[AVI_MAX_RIFFS]; // positions of AVIX RIFFs
+  uint8_t riffCnt;
+  uint32_t firstFrames; // frames in first RIFF
+  uint32_t firstMoviEnd; // end of movi list of first RIFF
+  uint32_t firstLen; // length of first RIFF
+  uint32_t moviEnd; // end of movi list of last RIFF
+  uint32_t fileLen;
+};
+static odmlState odml;
 char dayFolder[50];
 static const uint8_t zeroBuf[4] = {0x00, 0x00, 0x00, 0x00}; // 0000
 bool stopCheck = false;
 
+// SD writer task frame queue, queueBuffer used as ring buffer for copied jpegs
+struct segNames;
+struct queueItem {
+  camera_fb_t* fb; // camera frame buffer held until stored, else NULL if jpeg copied to queueBuffer
+  uint32_t jpegPos; // queue position of copied jpeg
+  uint32_t jpegLen; 
+  uint8_t type; // frameItem, or end of file action
+  uint32_t frameTime; // ms when frame captured, from camera timestamp, see frameMillis()
+  bool thumb; // most motion of segment so far, to use as thumbnail
+  segNames* names; // segment names for ROLL_ITEM / FLUSH_ITEM, as captureTask moves on before writerTask uses them
+};
+enum itemType {FRAME_ITEM, ROLL_ITEM, FLUSH_ITEM}; // frame, continue in next segment, end recording
+struct segment {
+  const uint8_t* data;
+  size_t len;
+};
+uint8_t fbCount = 1; // camera frame buffers, as set in camera config
+
+// frame index trailer, appended after final boundary of recording:
+// per frame index entry, then fixed size footer at end of file
+#define INDEX_MAGIC "MJIX"
+struct frameIndexEntry {
+  uint32_t offset; // file position of jpeg 
+  uint32_t len; // jpeg length, excluding filler
+  uint32_t time; // ms since first frame
+};
+struct indexFooter {
+  char magic[4]; // INDEX_MAGIC
+  uint32_t frames; // number of index entries
+  uint32_t indexPos; // file position of first index entry, also end of mjpeg content
+  uint32_t entryLen; // sizeof(frameIndexEntry)
+};
+// a long recording is stored as a chain of segment files, 
+// identified by base name (date folder and start time), inserted before footer
+#define SEGMENT_MAGIC "MJSG"
+#define BASE_NAME_LEN 32
+struct segmentInfo {
+  char magic[4]; // SEGMENT_MAGIC
+  uint32_t segment; // 0 for first
+  char prevBase[BASE_NAME_LEN]; // base name of previous segment, empty if first
+  char nextBase[BASE_NAME_LEN]; // base name of next segment, empty if last
+};
+struct segNames {
+  char closeName[100]; // final name of segment being ended, empty to discard
+  char nextBase[BASE_NAME_LEN]; // base name of segment started by ROLL_ITEM
+};
+static frameIndexEntry* frameIndex = NULL; // psram index of frames stored for current recording
+static uint32_t indexCnt = 0;
+static bool indexFull = false;
+
+// thumbnail frame chosen by captureTask from motion level, located in file by writerTask
+extern uint32_t motionLevel; // changed pixels at last motion check
+static uint32_t frameMotion = 0; // motion level of current frame, 0 if not checked
+static uint32_t thumbMotion = 0; // motion level of thumbnail frame in current segment
+static frameIndexEntry thumbFrame; // location of thumbnail frame in current segment file
+// thumbnail of closed segment file, saved by low priority thumbTask so that writerTask is not delayed
+struct thumbItem {
+  char mjpegName[100]; // closed segment file
+  frameIndexEntry frame; // location of thumbnail frame in file
+  uint8_t scale; // jpg_scale_t downscale of frame
+};
+static QueueHandle_t thumbQueue; // item kept in queue until thumbnail saved
+
+// latency histograms per pipeline stage, log scale buckets in us, kept across recordings
+enum latencyStage {LAT_FRAME, LAT_MOTION, LAT_QUEUE, LAT_ASSEMBLY, LAT_WRITE, LAT_OPEN, LAT_CLOSE, LAT_STAGES};
+static const char* latencyNames[LAT_STAGES] = {"frame", "motion", "queue", "assembly", "write", "open", "close"};
+struct latencyHist {
+  uint32_t buckets[LAT_BUCKETS];
+  uint32_t count;
+  uint32_t maxUs;
+  uint64_t totUs;
+};
+static latencyHist latency[LAT_STAGES];
+
+// jpeg quality control
+struct qualityChange {
+  uint16_t secs; // since start of recording
+  uint8_t quality;
+};
+static qualityChange qualityLog[QUALITY_LOG];
+static uint8_t qualityChanges; // number of changes in current recording
+static uint8_t qualityStart, qualityLow, qualityHigh; // quality range used in current recording
+static uint8_t qualityUser; // quality setting before recording started, restored when it closes
+static uint8_t qualitySet = 0; // quality last set by autoQuality in current recording, 0 if none
+static uint32_t lateTicks = 0; // frame timer ticks not processed on time by captureTask
+static uint32_t jpegBytes = 0; // jpeg bytes queued for current recording
+static uint32_t segSize = 0; // bytes queued for current segment file, including frame headers
+static volatile uint32_t sdWriteUs = 0; // SD write time in us, wraps round
+static volatile uint32_t sdWriteBytes = 0; // bytes written to SD in sdWriteUs, never reset as vidSize is, wraps round
+static uint32_t qualityWindow; // start of current quality control period, 0 at start of recording
+static QueueHandle_t frameQueue;
+static SemaphoreHandle_t fbSemaphore = NULL; // counts camera frame buffers that can be held in frame queue
+static SemaphoreHandle_t flushSemaphore;
+static volatile uint32_t queueHead; // bytes of jpegs copied to frame queue for current recording
+static volatile uint32_t queueTail; // bytes of copied jpegs stored to SD
+static size_t blockLen; // content of iSDbuffer waiting to be written
+static queueItem preRoll[PRE_ROLL_FRAMES]; // frames held prior to recording starting, oldest first
+static uint8_t preRollStart = 0;
+static uint8_t preRollCnt = 0;
+static size_t preRollBytes = 0; // bytes of pre-roll frames copied to queueBuffer
+static uint8_t preRollUsed; // pre-roll frames in current recording
+uint8_t queueHighWater = 0; // max frames waiting in frame queue for current recording
+uint16_t droppedFrames = 0; // frames dropped due to full frame queue for current recording
+// frame slot accounting for current recording
+uint16_t lateSlots = 0; // frame timer ticks processed late, catching up
+uint16_t skippedSlots = 0; // frame timer ticks not processed as too late
+uint16_t missingSlots = 0; // frame slots with no frame, from camera frame timestamps
+static uint32_t firstFrameTime; // capture time of first frame in current segment
+static uint32_t lastFrameTime; // capture time of latest frame, 0 if none
+// writerTask copy of segNames of item being actioned
+static char closeName[100];
+static char nextBase[BASE_NAME_LEN];
+static uint16_t segmentCnt = 0; // segments completed in current recording
+static char firstSegment[100]; // name of first segment of recording
+// writerTask segment files
+static char segTemp[100]; // temporary name of mjpegFile
+static char segBase[BASE_NAME_LEN]; // base name of mjpegFile
+static segmentInfo segInfo; // chain of current segment
+static File nextFile; // next segment, opened in advance
+static char nextTemp[100];
+static uint32_t segFrames; // frames stored in mjpegFile
+static uint32_t segStart; // time of first frame in mjpegFile
+
 // SD playback
-static File playbackFile;
 static char partName[100];
 static char optionHtml[200]; // used to build SD page html buffer
-static size_t readLen;
 static const char* needle = _STREAM_BOUNDARY;
-static bool firstCallPlay = true;
-static uint8_t recFPS;
-static uint32_t recDuration;
-static uint8_t saveFPS = 99;
-bool doPlayback = false;
+static const size_t partHdrLen = frameHdrLen - streamBoundaryLen; // part header before each jpeg
+static const size_t partPrefixLen = strchr(_STREAM_PART, '%') - _STREAM_PART; // part header before content length
+struct frameWalker {
+  size_t toBoundary; // remaining length of current frame to end of following boundary, 0 if next is header.
+                     // For AVI, remaining length of current chunk
+  bool inFrame; // content is of a frame, rather than leading boundary
+  bool resync; // searching for boundary after corrupt frame
+  size_t hdrHave; // length of part header, or AVI chunk header, held in hdr
+  char hdr[PART_BUF_LEN]; // for AVI, also part header generated for frame
+  bool boundaryDue; // for AVI, boundary to be generated after frame, or before first frame
+  bool skip; // for AVI, current chunk is not a frame
+};
+
+// concurrent playback sessions, one per browser tab, each with own buffers and pacing
+enum sessionState {SESSION_FREE, SESSION_SELECTED, SESSION_PLAYING};
+struct playSession {
+  volatile uint8_t state; // sessionState
+  uint32_t id; // given to browser tab when it selects a recording, to identify its later requests
+  uint32_t selectTime; // millis() when selected
+  char name[100]; // selected recording
+  File file;
+  uint32_t playbackEnd; // end of mjpeg content, or of AVI movi list, in current segment file
+  bool avi; // content being sent is of AVI file
+  bool fileAvi; // file being read is AVI
+  bool playlist; // play each recording in day folder named by name, in time order
+  File nextFile; // next segment or playlist file, opened before end of current file
+  uint32_t nextEnd; // end of mjpeg content, or of AVI movi list, in next file
+  bool nextAvi; // next file is AVI
+  uint32_t nextFrameUs; // usecs between frames of next file
+  bool nextChecked; // next file looked for
+  uint16_t fileCnt; // files played
+  uint8_t* buffer; // ring of READ_AHEAD blocks, sent from in place
+  size_t blockLen[READ_AHEAD]; // content length of each block, 0 at end of recording
+  bool tailBlockEnd[READ_AHEAD]; // tail reached end of recording when block read
+  uint32_t blockFrameUs[READ_AHEAD]; // usecs between frames of file each block was read from
+  bool blockAvi[READ_AHEAD]; // file each block was read from is AVI
+  uint8_t fillBlock; // next block to be read into by playbackTask
+  uint8_t sendBlock; // block being sent
+  uint8_t blocksAhead; // blocks requested from playbackTask, or read and waiting to be sent
+  uint32_t readEnd; // after fast forward skip, end of frame to be sent, which ring is read up to, else 0
+  uint32_t readPos; // file position ring reads have been requested up to, while readEnd set
+  SemaphoreHandle_t readSemaphore; // counts blocks read and waiting to be sent
+  bool priming; // ring being filled after start or seek, so waiting for a block is not an underrun
+  uint32_t underruns; // times the next block was not read in time
+  uint8_t* buff; // content of block being sent
+  size_t buffLen; // length of block being sent
+  size_t streamOffset; // position in block being sent
+  bool remaining; // block being sent not finished
+  bool atBoundary; // last content returned ended at a frame boundary
+  frameWalker walker; // playback position in frame
+  uint8_t recFPS;
+  uint32_t recDuration;
+  uint32_t frameUs; // usecs between frames at recorded rate, of file being sent
+  uint32_t fileFrameUs; // usecs between frames of file being read
+  volatile uint16_t speed; // playback speed as % of recorded rate
+  volatile uint8_t step; // fast forward, sending one frame in step frames, 1 for all frames
+  uint32_t frameDue; // micros() when next frame is due
+  uint32_t frameCnt; // number of next frame
+  uint32_t sentCnt; // frames sent
+  uint32_t skipCnt; // frames skipped by fast forward
+  uint32_t fileBlocks; // blocks read from current segment file
+  uint32_t vidSize;
+  uint32_t sTime, hTime; // playback start, last return
+  uint32_t rTimeTot, wTimeTot, fTimeTot, hTimeTot, tTimeTot; // SD read, SD wait, processing, http send, pacing times
+  volatile int32_t seekFrameNum; // pending seek to frame number
+  volatile int32_t seekMs; // pending seek to ms from start
+  volatile bool stop; // force stop
+  bool tail; // live tail of recording in progress
+  bool tailEnd; // tail has reached end of recording
+  uint32_t tailGen; // tail.gen of file being tailed
+  uint32_t tailPos; // position in file being tailed
+  frameIndexEntry* seekIndex; // frame offsets and times of file, loaded on first seek or fast forward
+  uint32_t seekCnt; // frames in seekIndex
+  char seekName[100]; // file loaded in seekIndex
+};
+static playSession sessions[MAX_SESSIONS];
+static uint8_t maxSessions = 0; // sessions whose buffers fit in PLAYBACK_PSRAM
+static QueueHandle_t readQueue; // sessions waiting for playbackTask to read ahead
+static SemaphoreHandle_t sessionMutex; // guards session allocation
+
+// live tail playback of recording in progress: content synced to SD is read from the file, 
+// and later content from a psram copy kept by writerTask while there are tail sessions
+struct tailState {
+  uint8_t readers; // tail playback sessions
+  uint32_t gen; // incremented when each file written is finished
+  char name[100]; // file being written, empty until writerTask starts copy
+  uint32_t synced; // content visible on SD to newly opened readers, followed by content copied to tailBuffer
+  uint32_t len; // length of content in tailBuffer
+  uint32_t end; // end of mjpeg content, before frame index trailer, 0 until known
+  char endName[100]; // final name of last finished file, empty if discarded
+  uint32_t endLen; // mjpeg content length of last finished file
+  bool rolled; // recording continues in next segment after last finished file
+};
+static tailState tail;
+static uint8_t* tailBuffer = NULL;
+static SemaphoreHandle_t tailMutex; // guards tail state shared by writerTask and tail playback reads
+static bool tailing = false; // writerTask is copying current file to tailBuffer
 
 // task control
 static TaskHandle_t captureHandle = NULL;
 static TaskHandle_t playbackHandle = NULL;
+static uint8_t* playBuffer = NULL; // playbackTask's own dma capable block for SD reads
+static TaskHandle_t writerHandle = NULL;
+static TaskHandle_t thumbHandle = NULL;
 extern TaskHandle_t getDS18tempHandle;
-static SemaphoreHandle_t readSemaphore;
-static SemaphoreHandle_t playbackSemaphore;
 SemaphoreHandle_t frameMutex;
 SemaphoreHandle_t motionMutex;
-static volatile bool isPlaying = false;
+SemaphoreHandle_t decodeMutex; // one jpeg decode at a time, for motion checks and thumbnails
+extern SemaphoreHandle_t aviMutex;
 bool isCapturing = false;
 uint8_t PIRpin;
 const uint8_t LAMPpin = 4;
@@ -135,11 +418,23 @@ static camera_fb_t* fb;
 
 bool isNight(uint8_t nightSwitch);
 bool checkMotion(camera_fb_t* fb, bool captureStatus);
+bool jpg2thumb(const uint8_t* src, size_t srcLen, uint8_t scale, uint8_t quality, uint8_t** out, size_t* outLen);
 void stopPlaying();
-void readSD();
 void prepSound();
 void startAudio();
 void finishAudio(const char* mjpegName, bool isvalid);
+void prepAviHeader(uint8_t* hdr, uint8_t frameType, uint32_t frames, uint32_t frameUs, size_t moviLen, size_t fileLen, size_t audLen);
+size_t aviFrameHdr(uint8_t* hdr, uint32_t jpegLen);
+size_t aviIndexHdr(uint8_t* hdr, uint32_t frames);
+size_t aviIndexEntry(uint8_t* entry, uint32_t offset, uint32_t jpegLen);
+size_t aviJunkHdr(uint8_t* hdr, uint32_t len);
+size_t aviSuperEntry(uint8_t* entry, uint32_t offset, uint32_t len, uint32_t frames);
+size_t aviStdIndexHdr(uint8_t* hdr, uint32_t frames, uint32_t baseOffset);
+size_t aviStdIndexEntry(uint8_t* entry, uint32_t offset, uint32_t jpegLen);
+size_t aviRiffHdr(uint8_t* hdr, uint32_t riffLen, uint32_t moviLen);
+size_t prepOdmlHeader(uint8_t* hdr, uint8_t frameType, uint32_t frames, uint32_t firstFrames, uint32_t frameUs, 
+  size_t moviLen, size_t firstLen, const uint8_t* superIndex, uint32_t superCnt);
+bool aviMovi(File &fh, uint32_t* moviStart, uint32_t* moviEnd);
 bool useMicrophone();
 String getOldestDir();
 void deleteFolderOrFile(const char* val);
@@ -244,7 +539,6 @@ static void IRAM_ATTR frameISR() {
   // interrupt at current frame rate
   BaseType_t xHigherPriorityTaskWoken = pdFALSE;
   vTaskNotifyGiveFromISR(captureHandle, &xHigherPriorityTaskWoken); // wake capture task to process frame
-  if (isPlaying) xSemaphoreGiveFromISR (playbackSemaphore, &xHigherPriorityTaskWoken ); // notify playback to send frame
   if (xHigherPriorityTaskWoken == pdTRUE) portYIELD_FROM_ISR();
 }
 
@@ -268,23 +562,173 @@ void controlFrameTimer(bool restartTimer) {
   }
 }
 
+/**************** latency histograms  ************************/
+
+static inline uint8_t latencyBucket(uint32_t us) {
+  // bucket index, each power of 2 split into 2^LAT_SUB_BITS buckets
+  if (us < (1 << LAT_SUB_BITS)) return us;
+  uint8_t msb = 31 - __builtin_clz(us);
+  uint8_t bucket = ((msb - LAT_SUB_BITS + 1) << LAT_SUB_BITS) + ((us >> (msb - LAT_SUB_BITS)) & ((1 << LAT_SUB_BITS) - 1));
+  return std::min(bucket, (uint8_t)(LAT_BUCKETS - 1));
+}
+
+static uint32_t bucketLimit(uint8_t bucket) {
+  // highest us value held in bucket
+  if (bucket < (1 << LAT_SUB_BITS)) return bucket;
+  uint8_t octave = bucket >> LAT_SUB_BITS;
+  uint32_t lower = (uint32_t)((1 << LAT_SUB_BITS) + (bucket & ((1 << LAT_SUB_BITS) - 1))) << (octave - 1);
+  return lower + (1 << (octave - 1)) - 1;
+}
+
+static void latencyAdd(latencyStage stage, uint32_t us) {
+  // each stage only updated by one task
+  latencyHist* hist = &latency[stage];
+  hist->buckets[latencyBucket(us)]++;
+  hist->count++;
+  hist->totUs += us;
+  if (us > hist->maxUs) hist->maxUs = us;
+}
+
+static uint32_t latencyPercentile(latencyHist* hist, uint8_t pct) {
+  // upper limit of bucket containing percentile, capped by max
+  uint32_t target = ((uint64_t)hist->count * pct + 99) / 100;
+  uint32_t cum = 0;
+  for (int i = 0; i < LAT_BUCKETS; i++) {
+    cum += hist->buckets[i];
+    if (cum >= target) return std::min(bucketLimit(i), hist->maxUs);
+  }
+  return hist->maxUs;
+}
+
+void resetLatency() {
+  memset(latency, 0, sizeof(latency));
+}
+
+void latencyStats(char* htmlBuff) {
+  // build json of latency percentiles and non empty buckets for each stage, in us
+  char* p = htmlBuff;
+  char* end = htmlBuff + htmlBuffLen - 4; // room to close json
+  p += snprintf(p, end - p, "{\"sdBlock\":%zu", sdBlockSize);
+  for (int s = 0; s < LAT_STAGES && p < end; s++) {
+    latencyHist* hist = &latency[s];
+    p += snprintf(p, end - p, ",\"%s\":{\"count\":%u,\"avg\":%u,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u,\"buckets\":[",
+      latencyNames[s], hist->count, hist->count ? (uint32_t)(hist->totUs / hist->count) : 0,
+      latencyPercentile(hist, 50), latencyPercentile(hist, 90), latencyPercentile(hist, 99), hist->maxUs);
+    // each bucket as [highest us, count]
+    bool first = true;
+    for (int i = 0; i < LAT_BUCKETS && p < end; i++) {
+      if (!hist->buckets[i]) continue;
+      p += snprintf(p, end - p, "%s[%u,%u]", first ? "" : ",", bucketLimit(i), hist->buckets[i]);
+      first = false;
+    }
+    if (p < end) p += snprintf(p, end - p, "]}");
+  }
+  if (p > end) p = end; 
+  strcpy(p, "}");
+}
+
 /**************** capture MJPEG  ************************/
 
+static void logQuality(uint8_t quality) {
+  // record quality change for recording stats
+  if (quality < qualityLow) qualityLow = quality;
+  if (quality > qualityHigh) qualityHigh = quality;
+  if (qualityChanges < QUALITY_LOG) qualityLog[qualityChanges++] = {(uint16_t)((millis() - startMjpeg) / 1000), quality};
+}
+
+static void startQuality() {
+  // at start of recording, keep jpeg quality within autoQuality bounds
+  sensor_t* s = esp_camera_sensor_get();
+  qualityChanges = qualityWindow = 0;
+  qualityStart = qualityLow = qualityHigh = qualityUser = s->status.quality;
+  qualitySet = 0;
+  jpegBytes = 0;
+  if (autoQuality) {
+    uint8_t quality = std::min(std::max(s->status.quality, qualityMin), std::max(qualityMin, qualityMax));
+    if (quality != s->status.quality) {
+      s->set_quality(s, quality);
+      qualitySet = quality;
+      qualityStart = qualityLow = qualityHigh = quality;
+    }
+  }
+}
+
+static void restoreQuality() {
+  // at end of recording, restore quality setting changed by autoQuality, unless since changed by user
+  sensor_t* s = esp_camera_sensor_get();
+  if (qualitySet && s->status.quality == qualitySet && qualitySet != qualityUser) {
+    s->set_quality(s, qualityUser);
+    showDebug("JPEG quality restored to %u", qualityUser);
+  }
+  qualitySet = 0;
+}
+
+static void controlQuality() {
+  // each QUALITY_SECS of recording, adjust jpeg quality so that frames at target FPS fit SD bandwidth
+  // reduce quality if frames are late or dropped, or SD load too high, increase if well within SD bandwidth
+  static uint32_t startFrames, startDropped, startLate, startBytes, startSdBytes, startSdUs;
+  if (!autoQuality) return;
+  uint32_t now = millis();
+  uint32_t elapsed = now - qualityWindow;
+  if (qualityWindow && elapsed < QUALITY_SECS * 1000) return;
+  uint32_t sdUs = sdWriteUs - startSdUs;
+  uint32_t sdBytes = sdWriteBytes - startSdBytes;
+  if (qualityWindow && frameCnt > startFrames && sdUs) {
+    uint32_t late = lateTicks - startLate;
+    uint32_t dropped = droppedFrames - startDropped;
+    uint32_t avgJpeg = (jpegBytes - startBytes) / (frameCnt - startFrames);
+    // % of SD write bandwidth needed to store jpegs of this size at target FPS
+    uint32_t sdLoad = (uint64_t)avgJpeg * FPS * 100 * sdUs / ((uint64_t)sdBytes * 1000000 + 1);
+    sensor_t* s = esp_camera_sensor_get();
+    int quality = s->status.quality;
+    if (dropped || late || sdLoad > SD_LOAD_HIGH) quality += (dropped || sdLoad > 100) ? 2 : 1;
+    else if (sdLoad < SD_LOAD_LOW) quality--;
+    quality = std::min(std::max(quality, (int)qualityMin), (int)std::max(qualityMin, qualityMax));
+    showDebug("Quality control: fps %0.1f, avg jpeg %u, SD load %u%%, late %u, dropped %u, quality %u -> %d", 
+      1000.0 * (frameCnt - startFrames) / elapsed, avgJpeg, sdLoad, late, dropped, s->status.quality, quality);
+    if (quality != s->status.quality) {
+      s->set_quality(s, quality);
+      qualitySet = quality;
+      logQuality(quality);
+    }
+  }
+  qualityWindow = now;
+  startFrames = frameCnt;
+  startDropped = droppedFrames;
+  startLate = lateTicks;
+  startBytes = jpegBytes;
+  startSdBytes = sdWriteBytes;
+  startSdUs = sdWriteUs;
+}
+
 static void openMjpeg() {
   // derive filename from date & time, store in date folder
   // time to open a new file on SD increases with the number of files already present
-  oTime = millis();
+  uint32_t openTime = micros();
   dateFormat(partName, sizeof(partName), true);
   SD_MMC.mkdir(partName); // make date folder if not present
-  dateFormat(partName, sizeof(partName), false);
+  dateFormat(segBase, sizeof(segBase), false);
+  strcpy(partName, segBase);
   // open mjpeg file with temporary name
   mjpegFile  = SD_MMC.open(partName, FILE_WRITE);
-  oTime = millis() - oTime;
+  strcpy(segTemp, partName);
+  recAvi = aviRecord;
+  // AVI needs frame index for its idx1 and standard index chunks
+  if (recAvi && !frameIndex) frameIndex = (frameIndexEntry*)ps_malloc(MAX_FRAMES * sizeof(frameIndexEntry));
+  if (recAvi && !frameIndex) showError("Insufficient pSRAM for frame index, so AVI will have no index");
+  segmentCnt = 0;
+  openTime = micros() - openTime;
+  latencyAdd(LAT_OPEN, openTime);
+  oTime = openTime / 1000;
   showDebug("File opening time: %ums", oTime);
   startAudio();
   // initialisation of counters
   startMjpeg = millis();
-  frameCnt = fTimeTot = wTimeTot = dTimeTot = highPoint = vidSize = 0;
+  frameCnt = qTimeTot = bTimeTot = wTimeTot = dTimeTot = vidSize = segSize = 0;
+  wUsTot = 0;
+  blockLen = queueHighWater = droppedFrames = preRollUsed = 0;
+  lateSlots = skippedSlots = missingSlots = lastFrameTime = thumbMotion = 0;
+  startQuality();
 } 
 
 static inline bool doMonitor(bool capturing) {
@@ -308,44 +752,557 @@ static inline void freeFrame() {
   delay(1);
 }
 
+static bool waitQueueSpace(size_t dataLen, uint32_t waitTime) {
+  // wait up to waitTime ms for frame queue to have space for data
+  uint32_t qTime = millis();
+  while (FRAME_QUEUE_SIZE - (queueHead - queueTail) < dataLen || !uxQueueSpacesAvailable(frameQueue)) {
+    if (millis() - qTime >= waitTime) return false;
+    delay(1);
+  }
+  return true;
+}
+
+static void queuePut(const uint8_t* data, size_t dataLen) {
+  // copy data into frame queue, wrapping round at end of buffer
+  size_t offset = queueHead % FRAME_QUEUE_SIZE;
+  size_t firstLen = std::min(dataLen, (size_t)FRAME_QUEUE_SIZE - offset);
+  memcpy(queueBuffer+offset, data, firstLen);
+  memcpy(queueBuffer, data+firstLen, dataLen-firstLen);
+  queueHead += dataLen;
+}
+
+static inline uint32_t frameMillis() {
+  // capture time in ms of camera frame, or now if not set by camera driver. The driver sets it from 
+  // gettimeofday(), so it is wall clock time that steps on NTP sync, and only compared with other frame times
+  if (!fb->timestamp.tv_sec && !fb->timestamp.tv_usec) return millis();
+  return (uint32_t)((uint64_t)fb->timestamp.tv_sec * 1000 + fb->timestamp.tv_usec / 1000);
+}
+
+static void frameTiming(uint32_t frameTime) {
+  // track capture times of recorded frames, counting frame slots with no frame
+  if (!lastFrameTime) firstFrameTime = frameTime;
+  else {
+    uint32_t slots = ((frameTime - lastFrameTime) * FPS + 500) / 1000; // frame timer intervals since last frame
+    if (slots > 1) missingSlots += slots - 1;
+  }
+  lastFrameTime = frameTime;
+}
+
+static uint32_t recordingTime() {
+  // duration in ms of current segment, from frame capture times
+  if (frameCnt < 2) return frameCnt * 1000 / FPS;
+  // span of first to last frame, plus average frame interval for last frame
+  return (uint64_t)(lastFrameTime - firstFrameTime) * frameCnt / (frameCnt - 1);
+}
+
+static void flushQueue(const char* finalName) {
+  // wait for writerTask to store all queued content, and close final segment as finalName, or discard if empty.
+  // Names are not in use by writerTask after flush, so can be static
+  static segNames flushNames;
+  strcpy(flushNames.closeName, finalName);
+  flushNames.nextBase[0] = 0;
+  queueItem item = {NULL, 0, 0, FLUSH_ITEM, 0, false, &flushNames};
+  xQueueSend(frameQueue, &item, portMAX_DELAY);
+  xSemaphoreTake(flushSemaphore, portMAX_DELAY);
+}
+
+static bool queueFrame(queueItem* item, uint32_t waitTime) {
+  // hold camera frame buffer if one can be spared, else copy jpeg to frame queue
+  *item = {NULL, 0, (uint32_t)fb->len, FRAME_ITEM, frameMillis(), false, NULL};
+  if (fbSemaphore && xSemaphoreTake(fbSemaphore, 0)) {
+    item->fb = fb;
+    fb = NULL; // prevent freeFrame() returning it to camera
+    return true;
+  } 
+  if (waitQueueSpace(item->jpegLen, waitTime)) {
+    item->jpegPos = queueHead;
+    queuePut(fb->buf, item->jpegLen);
+    return true;
+  }
+  return false;
+}
+
 static void saveFrame() {
-  // build frame boundary for jpeg 
-  uint32_t fTime = millis();
-  // add boundary to buffer
-  memcpy(SDbuffer+highPoint, _STREAM_BOUNDARY, streamBoundaryLen);
-  highPoint += streamBoundaryLen;
-  size_t jpegSize = fb->len; 
-  uint16_t filler = (4 - (jpegSize & 0x00000003)) & 0x00000003; // align end of jpeg on 4 byte boundary for subsequent AVI
-  jpegSize += filler;
-  size_t streamPartLen = snprintf((char*)part_buf, PART_BUF_LEN-1, _STREAM_PART, jpegSize);
-  memcpy(SDbuffer+highPoint, part_buf, streamPartLen); // marker at start of each mjpeg frame
-  highPoint += streamPartLen;
-  memcpy(SDbuffer+highPoint, fb->buf, jpegSize);
-  highPoint += jpegSize;                                                        
+  // queue jpeg for storage by writerTask
+  uint32_t qTime = micros();
+  queueItem item;
+  frameTiming(frameMillis());
+  // one queue space kept free for rollMjpeg()
+  if (uxQueueSpacesAvailable(frameQueue) > 1 && queueFrame(&item, QUEUE_WAIT)) {
+    if (frameMotion > thumbMotion) {
+      item.thumb = true;
+      thumbMotion = frameMotion;
+    }
+    xQueueSend(frameQueue, &item, 0);
+    uint8_t queueDepth = uxQueueMessagesWaiting(frameQueue);
+    if (queueDepth > queueHighWater) queueHighWater = queueDepth;
+    frameCnt++;
+    jpegBytes += item.jpegLen;
+    segSize += item.jpegLen + frameHdrLen + 3; // with filler
+  } else {
+    droppedFrames++;
+    showDebug("Frame dropped as frame queue full");
+  }
+  qTime = micros() - qTime;
+  qTimeTot += qTime;
+  latencyAdd(LAT_QUEUE, qTime);
+  showDebug("Frame queueing time %u us", qTime);
   freeFrame(); 
-  // only write to SD when at least RAMSIZE is available in buffer
-  uint32_t wTime = millis();
-  if (highPoint/RAMSIZE) {  
-    size_t remainder = highPoint % RAMSIZE;
-    size_t transferSize = highPoint-remainder;
-    for (int i=0; i<transferSize/RAMSIZE; i++) {
-      // copy psram to interim dram before writing
-      memcpy(iSDbuffer, SDbuffer+RAMSIZE*i, RAMSIZE);
-      mjpegFile.write(iSDbuffer, RAMSIZE);
-    }
-    // push remainder to buffer start, should not overlap
-    memcpy(SDbuffer, SDbuffer+transferSize, remainder);
-    highPoint = remainder;
-  } 
+  controlQuality();
+}
+
+static void releasePreRoll() {
+  // discard oldest pre-roll frame
+  queueItem* item = &preRoll[preRollStart];
+  if (item->fb) {
+    esp_camera_fb_return(item->fb);
+    xSemaphoreGive(fbSemaphore);
+  } else {
+    // oldest copied jpeg is at tail of queue as writerTask idle 
+    queueTail += item->jpegLen;
+    preRollBytes -= item->jpegLen;
+  }
+  preRollStart = (preRollStart + 1) % PRE_ROLL_FRAMES;
+  preRollCnt--;
+}
+
+static void preRollFrame() {
+  // hold frame while not recording, discarding oldest frames outside pre-roll time or size
+  if (!PRE_ROLL_SECS) return;
+  uint32_t now = frameMillis();
+  while (preRollCnt && (preRollCnt == PRE_ROLL_FRAMES || now - preRoll[preRollStart].frameTime > PRE_ROLL_SECS*1000
+    || preRollBytes + fb->len > PRE_ROLL_SIZE)) releasePreRoll();
+  queueItem* item = &preRoll[(preRollStart + preRollCnt) % PRE_ROLL_FRAMES];
+  if (queueFrame(item, 0)) {
+    if (!item->fb) preRollBytes += item->jpegLen;
+    preRollCnt++;
+  }
+}
+
+static void flushPreRoll() {
+  // pass pre-roll frames to writerTask at start of recording
+  if (preRollCnt) {
+    // recording starts with oldest frame, its age taken from frame times as these are not on millis() clock
+    uint32_t age = preRoll[(preRollStart + preRollCnt - 1) % PRE_ROLL_FRAMES].frameTime - preRoll[preRollStart].frameTime;
+    startMjpeg = millis() - std::min(age, (uint32_t)PRE_ROLL_SECS * 1000);
+  }
+  preRollUsed = preRollCnt;
+  while (preRollCnt) {
+    xQueueSend(frameQueue, &preRoll[preRollStart], portMAX_DELAY);
+    frameTiming(preRoll[preRollStart].frameTime);
+    segSize += preRoll[preRollStart].jpegLen + frameHdrLen + 3;
+    preRollStart = (preRollStart + 1) % PRE_ROLL_FRAMES;
+    preRollCnt--;
+    frameCnt++;
+  }
+  preRollBytes = 0;
+}
+
+static void tailPut(const uint8_t* data, size_t dataLen) {
+  // copy content just stored for any tail playback, syncing file to SD when copy full
+  if (!tail.readers || !tailBuffer) {
+    tailing = false;
+    return;
+  }
+  bool restart = !tailing || tail.len + dataLen > TAIL_BUFF;
+  if (restart) mjpegFile.flush(); // make content stored so far visible to tail readers
+  xSemaphoreTake(tailMutex, portMAX_DELAY);
+  if (restart) {
+    if (!tailing) strcpy(tail.name, segTemp);
+    tail.synced = mjpegFile.position();
+    tail.len = 0;
+    tailing = true;
+  } else {
+    memcpy(tailBuffer + tail.len, data, dataLen);
+    tail.len += dataLen;
+  }
+  xSemaphoreGive(tailMutex);
+}
+
+static void tailFinished(bool rolled) {
+  // tail readers complete finished file from SD, then any next segment
+  xSemaphoreTake(tailMutex, portMAX_DELAY);
+  strcpy(tail.endName, closeName);
+  tail.endLen = tail.end;
+  tail.rolled = rolled;
+  tail.gen++;
+  tail.name[0] = 0;
+  tail.synced = tail.len = tail.end = 0;
+  tailing = false;
+  xSemaphoreGive(tailMutex);
+}
+
+static void blockPut(const uint8_t* data, size_t dataLen) {
+  // assemble data into dram block, writing each completed block to SD
+  while (dataLen) {
+    size_t copyLen = std::min(dataLen, sdBlockSize - blockLen);
+    memcpy(iSDbuffer+blockLen, data, copyLen);
+    blockLen += copyLen;
+    data += copyLen;
+    dataLen -= copyLen;
+    if (blockLen == sdBlockSize) {
+      uint32_t wTime = micros();
+      mjpegFile.write(iSDbuffer, sdBlockSize);
+      wTime = micros() - wTime;
+      latencyAdd(LAT_WRITE, wTime);
+      wUsTot += wTime;
+      sdWriteUs += wTime;
+      sdWriteBytes += sdBlockSize;
+      tailPut(iSDbuffer, sdBlockSize);
+      blockLen = 0;
+    }
+  }
+}
+
+static void indexFrame(uint32_t offset, uint32_t len, uint32_t frameTime) {
+  // add stored frame to frame index. Once full, file has no trailer or idx1 chunk, but for AVI the
+  // frames not yet in a standard index chunk are kept, as OpenDML indexes only need these
+  if (!frameIndex || (indexFull && !recAvi)) return;
+  if (indexCnt == MAX_FRAMES) {
+    if (!indexFull) showError("Frame index full at %u frames, so segment has no %s", 
+      MAX_FRAMES, recAvi ? "idx1 chunk or frame index trailer" : "frame index trailer");
+    indexFull = true;
+    if (!recAvi || !odml.ixStart) return;
+    memmove(frameIndex, frameIndex + odml.ixStart, (indexCnt - odml.ixStart) * sizeof(frameIndexEntry));
+    indexCnt -= odml.ixStart;
+    odml.ixStart = 0;
+  }
+  static uint32_t firstFrameTime;
+  if (!indexCnt) firstFrameTime = frameTime;
+  frameIndex[indexCnt++] = {offset, len, frameTime - firstFrameTime};
+}
+
+static inline uint32_t paddedLen(uint32_t jpegLen) {
+  // AVI chunk content of jpeg, including filler
+  return jpegLen + ((4 - (jpegLen & 0x00000003)) & 0x00000003);
+}
+
+static void aviPut(const uint8_t* data, size_t len) {
+  // store AVI content other than frames, keeping vidSize as file position
+  blockPut(data, len);
+  vidSize += len;
+}
+
+static void writeStdIndex() {
+  // append OpenDML standard index chunk for frames since previous one, and add it to super index.
+  // AVI_IX_FRAMES and AVI_MAX_RIFFS are such that the super index does not fill
+  uint32_t frames = indexCnt - odml.ixStart;
+  if (!frameIndex || !frames || odml.superCnt >= AVI_SUPER_ENTRIES) return;
+  uint8_t entry[32];
+  size_t hdrLen = aviStdIndexHdr(entry, frames, odml.riffStart);
+  aviSuperEntry(odml.superIndex + odml.superCnt++ * 16, vidSize, hdrLen + frames * 8, frames);
+  aviPut(entry, hdrLen);
+  for (uint32_t i = odml.ixStart; i < indexCnt; i++) 
+    aviPut(entry, aviStdIndexEntry(entry, frameIndex[i].offset - odml.riffStart, paddedLen(frameIndex[i].len)));
+  odml.ixStart = indexCnt;
+}
+
+static void writeLegacyIndex(uint32_t frames) {
+  // append idx1 chunk for frames of first RIFF, for AVI 1.0 players
+  uint8_t entry[16];
+  if (!frameIndex || indexFull || !frames) return;
+  aviPut(entry, aviIndexHdr(entry, frames));
+  for (uint32_t i = 0; i < frames; i++) 
+    aviPut(entry, aviIndexEntry(entry, frameIndex[i].offset - AVI_CHUNK_HDR, paddedLen(frameIndex[i].len)));
+}
+
+static void nextRiff() {
+  // end first RIFF of AVI with its indexes and continue in an OpenDML AVIX RIFF, 
+  // or end AVIX RIFF with its standard index and continue in another
+  uint8_t hdr[24];
+  writeStdIndex();
+  if (!odml.riffCnt) {
+    odml.firstFrames = segFrames;
+    odml.firstMoviEnd = vidSize;
+    writeLegacyIndex(indexCnt);
+    odml.firstLen = vidSize;
+  }
+  odml.riffStart = odml.riffPos[odml.riffCnt++] = vidSize;
+  aviPut(hdr, aviRiffHdr(hdr, sizeof(hdr), sizeof(hdr) - 12)); // sizes set when file finished
+  showDebug("AVI continues in RIFF %u at %u", odml.riffCnt, vidSize);
+}
+
+static uint32_t writeAviEnd(bool haveIndex, size_t trailerLen) {
+  // end AVI movi list with a standard index chunk, and a single RIFF with its idx1 chunk, then any JUNK chunk 
+  // header for trailer, and prepare final header. Returns position of trailer
+  uint8_t hdr[AVI_CHUNK_HDR];
+  writeStdIndex();
+  odml.moviEnd = vidSize;
+  uint32_t frames = haveIndex ? indexCnt : segFrames;
+  if (!odml.riffCnt) {
+    odml.firstFrames = frames;
+    odml.firstMoviEnd = vidSize;
+    writeLegacyIndex(indexCnt);
+  }
+  if (trailerLen) aviPut(hdr, aviJunkHdr(hdr, trailerLen));
+  odml.fileLen = vidSize + trailerLen;
+  if (!odml.riffCnt) odml.firstLen = odml.fileLen;
+  uint32_t frameUs = (haveIndex && indexCnt > 1) ? (uint64_t)frameIndex[indexCnt - 1].time * 1000 / (indexCnt - 1) : 0;
+  if (!frameUs) frameUs = 1000000 / std::max(FPS, (uint8_t)1);
+  prepOdmlHeader(aviHdr, fsizePtr, frames, odml.firstFrames, frameUs, odml.firstMoviEnd - AVI_HDR_LEN, 
+    odml.firstLen, odml.superIndex, odml.superCnt);
+  return vidSize;
+}
+
+static void writeIndex() {
+  // append frame index, any segment chain, and footer after final boundary, then reset for next file.
+  // For AVI, the trailer follows the AVI indexes, in a JUNK chunk
+  static indexFooter footer;
+  if (recAvi) writeStdIndex(); // movi list ends with standard index
+  uint32_t indexPos = recAvi ? vidSize : vidSize + streamBoundaryLen;
+  xSemaphoreTake(tailMutex, portMAX_DELAY);
+  tail.end = indexPos; // tail playback excludes trailer
+  xSemaphoreGive(tailMutex);
+  bool haveIndex = frameIndex && !indexFull && indexCnt;
+  bool haveTrailer = FRAME_INDEX && haveIndex;
+  bool haveChain = segInfo.prevBase[0] || segInfo.nextBase[0];
+  if (recAvi) {
+    size_t trailerLen = haveTrailer ? indexCnt * sizeof(frameIndexEntry) + (haveChain ? sizeof(segInfo) : 0) + sizeof(footer) : 0;
+    indexPos = writeAviEnd(haveIndex, trailerLen);
+  }
+  if (haveTrailer) {
+    blockPut((const uint8_t*)frameIndex, indexCnt * sizeof(frameIndexEntry));
+    if (haveChain) blockPut((const uint8_t*)&segInfo, sizeof(segInfo));
+    footer = {{INDEX_MAGIC[0], INDEX_MAGIC[1], INDEX_MAGIC[2], INDEX_MAGIC[3]}, indexCnt, indexPos, sizeof(frameIndexEntry)};
+    blockPut((const uint8_t*)&footer, sizeof(footer));
+  }
+  indexCnt = 0;
+  indexFull = false;
+}
+
+static void openNextFile() {
+  // open file for next segment in advance, using alternate temporary name
+  uint32_t openTime = micros();
+  snprintf(nextTemp, sizeof(nextTemp), "/segment%u.tmp", (segInfo.segment + 1) % 2);
+  nextFile = SD_MMC.open(nextTemp, FILE_WRITE);
+  latencyAdd(LAT_OPEN, micros() - openTime);
+  showDebug("Opened %s for next segment in %lu us", nextTemp, micros() - openTime);
+}
+
+static bool isRecording(const char* fname) {
+  // recording file, as MJPEG or AVI
+  const char* ext = strrchr(fname, '.');
+  return ext && (!strcmp(ext + 1, MJPEGEXT) || !strcmp(ext + 1, AVIEXT));
+}
+
+static bool isAviFile(const char* fname) {
+  // recording made as AVI
+  const char* ext = strrchr(fname, '.');
+  return ext && !strcmp(ext + 1, AVIEXT);
+}
+
+void thumbName(char* thumb, const char* mjpegName, size_t thumbLen) {
+  // name of thumbnail sidecar for recording, with jpg instead of mjpeg extension
+  snprintf(thumb, thumbLen, "%s", mjpegName);
+  char* ext = strrchr(thumb, '.');
+  if (ext && (size_t)(ext - thumb) + strlen(THUMBEXT) + 2 <= thumbLen) strcpy(ext + 1, THUMBEXT);
+}
+
+static void saveThumb(const thumbItem* item) {
+  // save downscaled copy of chosen frame of closed segment file as jpeg sidecar
+  uint32_t tTime = micros();
+  uint8_t* jpeg = (uint8_t*)ps_malloc(item->frame.len);
+  uint8_t* thumb = NULL;
+  size_t thumbLen = 0;
+  File mjpeg = SD_MMC.open(item->mjpegName, FILE_READ);
+  bool res = jpeg && mjpeg && mjpeg.seek(item->frame.offset) && mjpeg.read(jpeg, item->frame.len) == item->frame.len;
+  if (mjpeg) mjpeg.close();
+  if (res) {
+    xSemaphoreTake(decodeMutex, portMAX_DELAY);
+    res = jpg2thumb(jpeg, item->frame.len, item->scale, THUMB_QUALITY, &thumb, &thumbLen);
+    xSemaphoreGive(decodeMutex);
+  }
+  free(jpeg);
+  if (res) {
+    char thumbFile[sizeof(item->mjpegName)];
+    thumbName(thumbFile, item->mjpegName, sizeof(thumbFile));
+    File fh = SD_MMC.open(thumbFile, FILE_WRITE);
+    res = fh && fh.write(thumb, thumbLen) == thumbLen;
+    if (fh) fh.close();
+  }
+  free(thumb);
+  if (!res) showError("Failed to save thumbnail for %s", item->mjpegName);
+  else showDebug("Saved %zu byte thumbnail of frame at %u ms in %lu ms", thumbLen, item->frame.time, (micros() - tTime) / 1000);
+}
+
+static void queueThumb(const char* mjpegName) {
+  // hand chosen frame of closed segment file to thumbTask, rather than decode it on writerTask
+  thumbItem item;
+  strcpy(item.mjpegName, mjpegName);
+  item.frame = thumbFrame;
+  item.scale = 3; // jpg_scale_t 1/8
+  while (item.scale && (frameData[fsizePtr].frameWidth >> item.scale) < THUMB_WIDTH) item.scale--;
+  if (xQueueSend(thumbQueue, &item, 0) != pdTRUE) showError("No thumbnail for %s as thumbnail queue full", mjpegName);
+}
+
+static void thumbTask(void*) {
+  // save thumbnail of each closed segment file, at lower priority than capture and storage
+  thumbItem item;
+  while (true) {
+    xQueuePeek(thumbQueue, &item, portMAX_DELAY);
+    // leave SD card to writerTask while frames are waiting to be stored
+    while (uxQueueMessagesWaiting(frameQueue)) delay(100);
+    saveThumb(&item);
+    xQueueReceive(thumbQueue, &item, 0);
+  }
+}
+
+static void finishFile() {
+  // write remaining partial block, then close file and rename as closeName, or delete
+  uint32_t wTime = micros();
+  mjpegFile.write(iSDbuffer, blockLen);
+  wTime = micros() - wTime;
+  latencyAdd(LAT_WRITE, wTime);
+  wUsTot += wTime;
+  sdWriteUs += wTime;
+  sdWriteBytes += blockLen;
+  tailPut(iSDbuffer, blockLen);
+  blockLen = 0;
+  if (recAvi && closeName[0]) {
+    // replace initial AVI header with one for final content, and set sizes of any AVIX RIFFs
+    mjpegFile.seek(0, SeekSet);
+    mjpegFile.write(aviHdr, AVI_HDR_LEN);
+    for (int i = 0; i < odml.riffCnt; i++) {
+      uint8_t hdr[24];
+      bool last = i == odml.riffCnt - 1;
+      uint32_t riffEnd = last ? odml.fileLen : odml.riffPos[i + 1];
+      uint32_t moviEnd = last ? odml.moviEnd : odml.riffPos[i + 1];
+      aviRiffHdr(hdr, riffEnd - odml.riffPos[i], moviEnd - odml.riffPos[i] - 12);
+      mjpegFile.seek(odml.riffPos[i], SeekSet);
+      mjpegFile.write(hdr, sizeof(hdr));
+    }
+  }
+  mjpegFile.close();
+  if (closeName[0]) {
+    char folder[sizeof(closeName)];
+    strcpy(folder, closeName);
+    *strrchr(folder, '/') = 0; 
+    if (segInfo.segment) SD_MMC.mkdir(folder); // date may have changed since recording started
+    SD_MMC.rename(segTemp, closeName);
+    if (THUMBNAIL && segFrames) queueThumb(closeName);
+  } else SD_MMC.remove(segTemp);
+}
+
+static void rollFile() {
+  // end current segment and continue recording in next segment file
+  strncpy(segInfo.nextBase, nextBase, BASE_NAME_LEN);
+  writeIndex();
+  finishFile();
+  tailFinished(true);
+  showInfo("Saved segment %u as %s, %0.2f MB", segInfo.segment, closeName, (float)vidSize / ONEMEG);
+  if (!nextFile) openNextFile(); // not opened in advance
+  mjpegFile = nextFile;
+  nextFile = File();
+  strcpy(segTemp, nextTemp);
+  strncpy(segInfo.prevBase, segBase, BASE_NAME_LEN);
+  strncpy(segBase, nextBase, BASE_NAME_LEN);
+  segInfo.nextBase[0] = 0;
+  segInfo.segment++;
+  segFrames = vidSize = bTimeTot = wUsTot = 0;
+}
+
+static void endRecording() {
+  // end last segment of recording, and discard any file opened in advance
+  segInfo.nextBase[0] = 0;
+  writeIndex();
+  finishFile();
+  tailFinished(false);
+  if (nextFile) {
+    nextFile.close();
+    SD_MMC.remove(nextTemp);
+    nextFile = File();
+  }
+  segInfo.prevBase[0] = 0;
+  segInfo.segment = segFrames = 0;
+}
+
+static void writerTask(void*) {
+  // store frames from frame queue to SD in sdBlockSize blocks, 
+  // assembled directly from frame boundary, header and jpeg locations
+  queueItem item;
+  memcpy(segInfo.magic, SEGMENT_MAGIC, sizeof(segInfo.magic));
+  while (true) {
+    xQueueReceive(frameQueue, &item, portMAX_DELAY);
+    uint64_t wUsStart = wUsTot;
+    uint32_t bTime = micros();
+    segment segs[5];
+    uint8_t segCnt = 0;
+    if (recAvi && !vidSize) {
+      // AVI header at start of file, rewritten when file finished
+      memset(&odml, 0, sizeof(odml));
+      prepOdmlHeader(aviHdr, fsizePtr, 0, 0, 1000000 / std::max(FPS, (uint8_t)1), 0, AVI_HDR_LEN, odml.superIndex, 0);
+      segs[segCnt++] = {aviHdr, AVI_HDR_LEN};
+      vidSize = AVI_HDR_LEN;
+    }
+    if (item.type != FRAME_ITEM) {
+      if (!recAvi) segs[segCnt++] = {(const uint8_t*)_STREAM_BOUNDARY, streamBoundaryLen}; // final boundary
+    } else {
+      uint16_t filler = (4 - (item.jpegLen & 0x00000003)) & 0x00000003; // align end of jpeg on 4 byte boundary for subsequent AVI
+      size_t hdrLen; // content before jpeg
+      if (recAvi) {
+        // continue in next RIFF if frame and indexes still to be written would take RIFF past AVI_RIFF_MAX
+        size_t indexLen = (indexCnt - odml.ixStart + 1) * 8 + (odml.riffCnt ? 0 : (indexCnt + 1) * 16) + 64;
+        if (odml.riffCnt < AVI_MAX_RIFFS && vidSize - odml.riffStart + AVI_CHUNK_HDR + item.jpegLen + indexLen > AVI_RIFF_MAX) {
+          for (int i = 0; i < segCnt; i++) blockPut(segs[i].data, segs[i].len);
+          segCnt = 0;
+          nextRiff();
+        }
+        hdrLen = aviFrameHdr((uint8_t*)part_buf, item.jpegLen + filler);
+        segs[segCnt++] = {(const uint8_t*)part_buf, hdrLen}; // chunk header of each AVI frame
+      } else {
+        size_t streamPartLen = snprintf((char*)part_buf, PART_BUF_LEN-1, _STREAM_PART, item.jpegLen + filler);
+        segs[segCnt++] = {(const uint8_t*)_STREAM_BOUNDARY, streamBoundaryLen};
+        segs[segCnt++] = {(const uint8_t*)part_buf, streamPartLen}; // marker at start of each mjpeg frame
+        hdrLen = streamBoundaryLen + streamPartLen;
+      }
+      if (item.fb) segs[segCnt++] = {item.fb->buf, item.jpegLen};
+      else {
+        // copied jpeg may wrap round end of frame queue
+        size_t offset = item.jpegPos % FRAME_QUEUE_SIZE;
+        size_t firstLen = std::min((size_t)item.jpegLen, (size_t)FRAME_QUEUE_SIZE - offset);
+        segs[segCnt++] = {queueBuffer+offset, firstLen};
+        segs[segCnt++] = {queueBuffer, item.jpegLen - firstLen};
+      }
+      segs[segCnt++] = {zeroBuf, filler};
+      indexFrame(vidSize + hdrLen, item.jpegLen, item.frameTime);
+      if (item.thumb || !segFrames) thumbFrame = {(uint32_t)(vidSize + hdrLen), item.jpegLen, 
+        segFrames ? item.frameTime - segStart : 0};
+      vidSize += hdrLen + item.jpegLen + filler;
+      if (!segFrames++) segStart = item.frameTime;
+    }
+    for (int i = 0; i < segCnt; i++) blockPut(segs[i].data, segs[i].len);
+    if (recAvi && item.type == FRAME_ITEM && indexCnt - odml.ixStart >= AVI_IX_FRAMES) writeStdIndex();
+    // release jpeg location
+    if (item.fb) {
+      esp_camera_fb_return(item.fb);
+      xSemaphoreGive(fbSemaphore);
+    } else queueTail += item.jpegLen;
+    if (item.names) {
+      strcpy(closeName, item.names->closeName);
+      strcpy(nextBase, item.names->nextBase);
+      if (item.type == ROLL_ITEM) free(item.names);
+    }
+    if (item.type == ROLL_ITEM) rollFile();
+    else if (item.type == FLUSH_ITEM) endRecording();
+    else {
+      uint32_t wTime = wUsTot - wUsStart;
+      bTime = micros() - bTime - wTime;
+      bTimeTot += bTime;
+      latencyAdd(LAT_ASSEMBLY, bTime);
+      showDebug("SD storage time %u us", wTime);
+      // open next segment file in advance when near end of segment, if not busy
+      if (!nextFile && uxQueueMessagesWaiting(frameQueue) < 2 && (segFrames + PREOPEN_SECS * FPS >= MAX_FRAMES 
+          || (uint64_t)vidSize * (segFrames + PREOPEN_SECS * FPS) >= (uint64_t)MAX_SEG_SIZE * segFrames
+          || (segmentSecs && item.frameTime - segStart + PREOPEN_SECS * 1000 >= segmentSecs * 1000))) openNextFile();
+    }
+    if (item.type == FLUSH_ITEM) xSemaphoreGive(flushSemaphore);
+  }
+  vTaskDelete(NULL);
+}
 
-  wTime = millis() - wTime;
-  wTimeTot += wTime;
-  vidSize += streamPartLen+jpegSize+filler+streamBoundaryLen;
-  showDebug("SD storage time %u ms", wTime);
-  frameCnt++;
-  fTime = millis() - fTime - wTime;
-  fTimeTot += fTime;
-  showDebug("Frame processing time %u ms", fTime);
+uint8_t frameQueueDepth() {
+  // number of frames waiting to be stored
+  return frameQueue ? uxQueueMessagesWaiting(frameQueue) : 0;
 }
 
 bool checkFreeSpace() { //Check for sufficient space in card
@@ -365,35 +1322,66 @@ bool checkFreeSpace() { //Check for sufficient space in card
   return false;
 }                                                            
 
+static float segmentName(char* segName, size_t nameLen) {
+  // name for current segment, to include actual FPS, duration, and frame count, plus file extension
+  vidDuration = recordingTime();
+  float actualFPS = (1000.0f * (float)frameCnt) / ((float)vidDuration);
+  if (snprintf(segName, nameLen-1, "%s_%s_%lu_%lu_%u.%s", partName, frameData[fsizePtr].frameSizeStr, 
+    lround(actualFPS), lround(vidDuration/1000.0), frameCnt, recAvi ? AVIEXT : MJPEGEXT) >= (int)nameLen-1) 
+    showError("Segment name truncated to %s", segName);
+  return actualFPS;
+}
+
+static void rollMjpeg() {
+  // continue recording in next segment file on next frame, 
+  // with writerTask closing and renaming current segment and switching to next file.
+  // Not to delay capture, roll is retried on next frame if it cannot be queued now
+  char nextPart[BASE_NAME_LEN];
+  segNames* names = (segNames*)malloc(sizeof(segNames));
+  if (!names) return;
+  segmentName(names->closeName, sizeof(names->closeName));
+  dateFormat(names->nextBase, sizeof(names->nextBase), false);
+  // names are freed by writerTask once queued
+  if (!segmentCnt) strcpy(firstSegment, names->closeName);
+  strcpy(nextPart, names->nextBase);
+  queueItem item = {NULL, 0, 0, ROLL_ITEM, (uint32_t)millis(), false, names};
+  if (xQueueSend(frameQueue, &item, 0) != pdTRUE) {
+    free(names);
+    showDebug("Segment roll deferred as frame queue full");
+    return;
+  }
+  showInfo("Recording continues in segment %u after %u frames in %0.1f secs, dropped frames: %u, missing frame slots: %u", 
+    segmentCnt + 1, frameCnt, (float)vidDuration / 1000.0, droppedFrames, missingSlots);
+  // restart counters for next segment
+  strcpy(partName, nextPart);
+  segmentCnt++;
+  startMjpeg = millis();
+  frameCnt = qTimeTot = dTimeTot = segSize = 0;
+  queueHighWater = droppedFrames = preRollUsed = qualityWindow = 0;
+  lateSlots = skippedSlots = missingSlots = lastFrameTime = thumbMotion = 0;
+}
+
 static bool closeMjpeg() {
-  // closes and renames the file
-  uint32_t captureTime = frameCnt/FPS;
-  if (captureTime > minSeconds) { 
-    cTime = millis(); 
-    // add final boundary to buffer
-    memcpy(SDbuffer+highPoint, _STREAM_BOUNDARY, streamBoundaryLen);
-    highPoint += streamBoundaryLen;
-    // write remaining frame content to SD
-    mjpegFile.write(SDbuffer, highPoint); 
-    showDebug("Final SD storage time %lu ms", millis() - cTime); 
-
-    // finalise file on SD
-    uint32_t hTime = millis();
-    vidDuration = millis() - startMjpeg;
-    float actualFPS = (1000.0f * (float)frameCnt) / ((float)vidDuration);
-    mjpegFile.close();
-    // rename file to include actual FPS, duration, and frame count, plus file extension
-    snprintf(mjpegName, sizeof(mjpegName)-1, "%s_%s_%lu_%lu_%u.%s", 
-      partName, frameData[fsizePtr].frameSizeStr, lround(actualFPS), lround(vidDuration/1000.0), frameCnt, MJPEGEXT);
-    SD_MMC.rename(partName, mjpegName);
-    finishAudio(mjpegName, true);
-    showDebug("MJPEG close/rename time %lu ms", millis() - hTime); 
-    cTime = millis() - cTime;
+  // final segment is closed and renamed by writerTask
+  uint32_t captureTime = recordingTime() / 1000;
+  restoreQuality();
+  if (captureTime > minSeconds || segmentCnt) { 
+    uint32_t closeTime = micros(); 
+    float actualFPS = segmentName(mjpegName, sizeof(mjpegName));
+    // write remaining frame content and final boundary to SD, then close and rename file
+    flushQueue(mjpegName);
+    showDebug("Final SD storage and close time %lu ms", (micros() - closeTime) / 1000); 
+    finishAudio(segmentCnt ? firstSegment : mjpegName, true); // audio is kept with first segment
+    closeTime = micros() - closeTime;
+    latencyAdd(LAT_CLOSE, closeTime);
+    cTime = closeTime / 1000;
+    wTimeTot = wUsTot / 1000;
     insufficient = 0;
 
     // MJPEG stats
     showInfo("\n******** MJPEG recording stats ********");
     showInfo("Recorded %s", mjpegName);
+    if (segmentCnt) showInfo("Final segment %u of recording starting %s", segmentCnt, firstSegment);
     showInfo("MJPEG duration: %0.1f secs", (float)vidDuration / 1000.0); 
     showInfo("Number of frames: %u", frameCnt);
     showInfo("Required FPS: %u", FPS);    
@@ -402,20 +1390,35 @@ static bool closeMjpeg() {
     if (frameCnt) {
       showInfo("Average frame length: %u bytes", vidSize / frameCnt);
       showInfo("Average frame monitoring time: %u ms", dTimeTot / frameCnt);
-      showInfo("Average frame buffering time: %u ms", fTimeTot / frameCnt);
+      showInfo("Average frame buffering time: %0.2f ms (queueing %0.2f ms, SD block assembly %0.2f ms)", 
+        (float)(qTimeTot + bTimeTot) / frameCnt / 1000.0, (float)qTimeTot / frameCnt / 1000.0, (float)bTimeTot / frameCnt / 1000.0);
       showInfo("Average frame storage time: %u ms", wTimeTot / frameCnt);
     }
-    showInfo("Average SD write speed: %u kB/s", ((vidSize / wTimeTot) * 1000) / 1024);
+    showInfo("Pre-roll frames: %u", preRollUsed);
+    if (autoQuality || qualityChanges) {
+      // quality trajectory as secs:quality
+      char qualityStr[QUALITY_LOG * 10] = "";
+      for (int i = 0; i < qualityChanges; i++) 
+        sprintf(qualityStr + strlen(qualityStr), " %u:%u", qualityLog[i].secs, qualityLog[i].quality);
+      showInfo("JPEG quality: start %u, best %u, worst %u, changes%s%s", qualityStart, qualityLow, qualityHigh, 
+        qualityChanges ? "" : " none", qualityStr);
+    }
+    showInfo("Frame queue high water: %u frames, dropped frames: %u", queueHighWater, droppedFrames);
+    showInfo("Frame slots late: %u, skipped: %u, missing: %u", lateSlots, skippedSlots, missingSlots);
+    showInfo("Average SD write speed: %u kB/s", ((vidSize / std::max(wTimeTot, (uint32_t)1)) * 1000) / 1024);
+    latencyHist* hist = &latency[LAT_WRITE];
+    showInfo("SD write latency since startup: p50 %u us, p90 %u us, p99 %u us, max %u us", 
+      latencyPercentile(hist, 50), latencyPercentile(hist, 90), latencyPercentile(hist, 99), hist->maxUs);
     showInfo("File open / completion times: %u ms / %u ms", oTime, cTime);
-    showInfo("Busy: %u%%", std::min(100 * (wTimeTot+fTimeTot+dTimeTot+oTime+cTime) / vidDuration, (uint32_t)100));
+    showInfo("Busy: %u%%", std::min(100 * (wTimeTot+(qTimeTot+bTimeTot)/1000+dTimeTot+oTime+cTime) / vidDuration, (uint32_t)100));
     showInfo("Free heap: %u, free pSRAM %u", ESP.getFreeHeap(), ESP.getFreePsram());
     showInfo("*************************************\n");
+    segmentCnt = 0;
     checkFreeSpace();                     
     return true;
   } else {
     // delete too small files if exist
-    mjpegFile.close();
-    SD_MMC.remove(partName);
+    flushQueue("");
     finishAudio(partName, false);
     showDebug("Insufficient capture duration: %u secs", captureTime);
     insufficient++;
@@ -433,13 +1436,20 @@ static boolean processFrame() {
   uint32_t dTime = millis();
   bool finishRecording = false;
   
+  uint32_t lTime = micros();
   xSemaphoreTake(frameMutex,portMAX_DELAY);
   fb = esp_camera_fb_get();
+  latencyAdd(LAT_FRAME, micros() - lTime);
   if (fb) {
     // determine if time to monitor, then get motion capture status
     if (USE_MOTION) {
+      bool checked = true;
+      lTime = micros();
       if (debugMotion) checkMotion(fb, false); // check each frame for debug
       else if (doMonitor(isCapturing)) captureMotion = checkMotion(fb, isCapturing); // check 1 in N frames
+      else checked = false;
+      if (checked) latencyAdd(LAT_MOTION, micros() - lTime);
+      frameMotion = checked ? motionLevel : 0;
       nightTime = isNight(nightSwitch); 
       if (nightTime) {
         // dont record if night time as image shift is spurious
@@ -457,6 +1467,7 @@ static boolean processFrame() {
         stopPlayback  = true; // stop any subsequent playback
         showDebug("Capture started by %s%s", captureMotion ? "Motion " : "", capturePIR ? "PIR" : "");
         openMjpeg();  
+        flushPreRoll();
         wasCapturing = true;
       }
       if (isCapturing && wasCapturing) {
@@ -464,19 +1475,17 @@ static boolean processFrame() {
         dTimeTot += millis()-dTime; 
         saveFrame();
         showProgress();
-        if (frameCnt >= MAX_FRAMES) {
-          showInfo("Auto closed recording after %u frames", MAX_FRAMES);
-          finishRecording = true;
-        }
+        // long recording continues in a new segment file
+        if (frameCnt >= MAX_FRAMES || segSize >= MAX_SEG_SIZE || (segmentSecs && millis() - startMjpeg >= segmentSecs * 1000)) rollMjpeg();
       }
-      freeFrame();
       if (!isCapturing && wasCapturing) {
         // movement stopped 
         finishRecording = true;
-      }
+      } else if (!isCapturing) preRollFrame(); // hold frame in case recording starts
+      freeFrame();
       wasCapturing = isCapturing;
       
-    } 
+    } else while (preRollCnt) releasePreRoll();
     showDebug("============================");
   } else {
     showError("Failed to get frame");
@@ -494,13 +1503,23 @@ static boolean processFrame() {
   return res;
 }
 
-static void captureTask(void* parameter) {
+static void captureTask(void*) {
   // woken by frame timer when time to capture frame
   uint32_t ulNotifiedValue;
   while (true) {
     ulNotifiedValue = ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-    if (ulNotifiedValue > 5) ulNotifiedValue = 5; // prevent too big queue if FPS excessive
     // may be more than one isr outstanding if the task delayed by SD write or jpeg decode
+    if (ulNotifiedValue > 1) {
+      // capture falling behind frame timer
+      lateTicks += ulNotifiedValue - 1; 
+      if (isCapturing) lateSlots += ulNotifiedValue - 1;
+    }
+    if (ulNotifiedValue > MAX_CATCHUP) {
+      // prevent too big queue if FPS excessive
+      if (isCapturing) skippedSlots += ulNotifiedValue - MAX_CATCHUP;
+      ulNotifiedValue = MAX_CATCHUP; 
+    }
+    // recorded frame times are from camera timestamps, so catching up does not distort timing
     while(ulNotifiedValue-- > 0) processFrame();
   }
   vTaskDelete(NULL);
@@ -512,7 +1531,6 @@ uint8_t setFPS(uint8_t val) {
     FPS = val;
     // change frame timer which drives the task
     controlFrameTimer(true); 
-    saveFPS = FPS; // used to reset FPS after playback
   }
   return FPS;
 }
@@ -553,31 +1571,416 @@ int* extractMeta(const char* fname) {
   return meta;
 }
 
-static void playbackFPS(const char* fname) {
-  // extract meta data from filename to commence playback
-  int* meta = extractMeta(fname);
-  recFPS = meta[1];
-  recDuration = meta[2];
-  // temp change framerate to recorded framerate
-  FPS = recFPS;
-  controlFrameTimer(true); // set frametimer
+static size_t readFooter(File &fh, indexFooter* footer) {
+  // read and validate trailer footer, returning trailer length, or 0 if none
+  size_t fileSize = fh.size();
+  if (fileSize < sizeof(indexFooter)) return 0;
+  size_t filePos = fh.position();
+  fh.seek(fileSize - sizeof(indexFooter), SeekSet);
+  bool haveIndex = fh.read((uint8_t*)footer, sizeof(indexFooter)) == sizeof(indexFooter)
+    && !memcmp(footer->magic, INDEX_MAGIC, sizeof(footer->magic)) && footer->entryLen == sizeof(frameIndexEntry);
+  fh.seek(filePos, SeekSet);
+  if (!haveIndex) return 0;
+  // optional segment chain between index and footer
+  uint64_t trailerLen = (uint64_t)footer->frames * footer->entryLen + sizeof(indexFooter);
+  if (footer->indexPos + trailerLen == fileSize) return trailerLen;
+  if (footer->indexPos + trailerLen + sizeof(segmentInfo) == fileSize) return trailerLen + sizeof(segmentInfo);
+  return 0;
 }
 
-void openSDfile() {
-  // open selected file on SD for streaming 
-  if (stopPlayback) showError("Playback refused - capture in progress");
-  else {
-    stopPlaying(); // in case already running
-    showInfo("Playing %s", mjpegName);
-    playbackFile = SD_MMC.open(mjpegName, FILE_READ);
-    vidSize = playbackFile.size();
-    playbackFPS(mjpegName);  
-    // load first cluster ready for first request
-    firstCallPlay = true;
-    isPlaying = true; // task control
-    doPlayback = true; // browser control
-    readSD(); // prime playback task
+uint32_t readIndexFooter(File &fh, uint32_t* indexPos) {
+  // return number of frames in frame index trailer, or 0 if none, eg older recording.
+  // indexPos is set to end of mjpeg content, so trailer is not treated as frame data
+  indexFooter footer;
+  *indexPos = fh.size();
+  if (!readFooter(fh, &footer)) return 0;
+  *indexPos = footer.indexPos;
+  return footer.frames;
+}
+
+bool readSegmentInfo(File &fh, segmentInfo* seg) {
+  // get chain of segment file, if part of a multi segment recording
+  indexFooter footer;
+  size_t trailerLen = readFooter(fh, &footer);
+  if (!trailerLen || trailerLen == footer.frames * footer.entryLen + sizeof(indexFooter)) return false;
+  size_t filePos = fh.position();
+  fh.seek(fh.size() - sizeof(indexFooter) - sizeof(segmentInfo), SeekSet);
+  bool haveSeg = fh.read((uint8_t*)seg, sizeof(segmentInfo)) == sizeof(segmentInfo) 
+    && !memcmp(seg->magic, SEGMENT_MAGIC, sizeof(seg->magic));
+  fh.seek(filePos, SeekSet);
+  seg->prevBase[BASE_NAME_LEN-1] = seg->nextBase[BASE_NAME_LEN-1] = 0;
+  return haveSeg;
+}
+
+bool readFrameEntry(File &fh, uint32_t indexPos, uint32_t frameNum, frameIndexEntry* entry) {
+  // get index entry for frame from trailer, and position file at start of its mjpeg boundary, or AVI chunk header
+  if (!fh.seek(indexPos + frameNum * sizeof(frameIndexEntry), SeekSet)) return false;
+  if (fh.read((uint8_t*)entry, sizeof(frameIndexEntry)) != sizeof(frameIndexEntry)) return false;
+  return fh.seek(entry->offset - (isAviFile(fh.name()) ? AVI_CHUNK_HDR : frameHdrLen), SeekSet);
+}
+
+uint32_t indexedFrameUs(File &fh) {
+  // average usecs between frames, from capture times in frame index trailer, or 0 if none
+  uint32_t indexPos;
+  frameIndexEntry entry;
+  uint32_t frames = readIndexFooter(fh, &indexPos);
+  size_t filePos = fh.position();
+  bool haveTimes = frames > 1 && readFrameEntry(fh, indexPos, frames - 1, &entry) && entry.time;
+  fh.seek(filePos, SeekSet);
+  return haveTimes ? (uint64_t)entry.time * 1000 / (frames - 1) : 0;
+}
+
+static bool loadSeekIndex(playSession* s) {
+  // on first seek in file, load position of each frame header and frame time into pSRAM, 
+  // from frame index trailer if present, else from a single pass over frame headers
+  if (s->seekCnt && !strcmp(s->seekName, s->file.name())) return true; // already loaded
+  if (!s->seekIndex) s->seekIndex = (frameIndexEntry*)ps_malloc(MAX_FRAMES * sizeof(frameIndexEntry));
+  if (!s->seekIndex) return false;
+  frameIndexEntry* seekIndex = s->seekIndex;
+  uint32_t seekCnt;
+  uint32_t iTime = millis();
+  uint32_t indexPos;
+  seekCnt = std::min(readIndexFooter(s->file, &indexPos), (uint32_t)MAX_FRAMES);
+  bool haveTrailer = seekCnt;
+  if (haveTrailer) {
+    s->file.seek(indexPos, SeekSet);
+    seekCnt = s->file.read((uint8_t*)seekIndex, seekCnt * sizeof(frameIndexEntry)) / sizeof(frameIndexEntry);
+    for (uint32_t i = 0; i < seekCnt; i++) seekIndex[i].offset -= s->fileAvi ? AVI_CHUNK_HDR : partHdrLen;
+  } else if (s->fileAvi) {
+    // step from chunk to chunk of movi list
+    uint8_t hdr[AVI_CHUNK_HDR];
+    uint32_t chunkPos, moviEnd;
+    if (aviMovi(s->file, &chunkPos, &moviEnd)) {
+      while (seekCnt < MAX_FRAMES && chunkPos + AVI_CHUNK_HDR <= moviEnd) {
+        if (!s->file.seek(chunkPos, SeekSet) || s->file.read(hdr, AVI_CHUNK_HDR) != AVI_CHUNK_HDR) break;
+        uint32_t len = hdr[4] | hdr[5] << 8 | hdr[6] << 16 | (uint32_t)hdr[7] << 24;
+        if (!memcmp(hdr, "00dc", 4)) {
+          seekIndex[seekCnt] = {chunkPos, len, seekCnt * 1000 / std::max(s->recFPS, (uint8_t)1)};
+          seekCnt++;
+        }
+        // step into OpenDML AVIX RIFF and its movi list, else over chunk
+        if (!memcmp(hdr, "RIFF", 4) || !memcmp(hdr, "LIST", 4)) chunkPos += AVI_CHUNK_HDR + 4;
+        else chunkPos += AVI_CHUNK_HDR + len + (len & 1);
+      }
+    }
+  } else {
+    // older recording, step from header to header using content length, without reading jpegs
+    char hdr[frameHdrLen + 17];
+    uint32_t framePos = 0;
+    while (seekCnt < MAX_FRAMES && framePos + frameHdrLen < indexPos) {
+      s->file.seek(framePos, SeekSet);
+      size_t hLen = s->file.read((uint8_t*)hdr, sizeof(hdr) - 1);
+      if (hLen < frameHdrLen || memcmp(hdr, _STREAM_BOUNDARY, streamBoundaryLen)) break;
+      hdr[hLen] = 0;
+      char* lenStr = strstr(hdr + streamBoundaryLen, "Content-Length:");
+      char* jpegStart = strstr(hdr + streamBoundaryLen, "\r\n\r\n");
+      if (!lenStr || !jpegStart) break;
+      seekIndex[seekCnt] = {(uint32_t)(framePos + streamBoundaryLen), (uint32_t)atoi(lenStr + 15), seekCnt * 1000 / std::max(s->recFPS, (uint8_t)1)};
+      framePos += jpegStart + 4 - hdr + seekIndex[seekCnt++].len;
+    }
+  }
+  s->seekCnt = seekCnt;
+  strcpy(s->seekName, s->file.name());
+  showInfo("Loaded seek index of %u frames from %s in %lu ms", seekCnt, haveTrailer ? "trailer" : "headers", millis() - iTime);
+  return seekCnt > 0;
+}
+
+static uint32_t seekPosition(playSession* s) {
+  // get file position of header of requested frame, and frame number, or 0 if failed
+  int32_t frameNum = s->seekFrameNum;
+  int32_t ms = s->seekMs;
+  s->seekFrameNum = s->seekMs = -1;
+  uint32_t seekPos = 0;
+  if (loadSeekIndex(s)) {
+    if (ms >= 0) {
+      // first frame at or after requested time
+      uint32_t lo = 0, hi = s->seekCnt - 1;
+      while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (s->seekIndex[mid].time < (uint32_t)ms) lo = mid + 1;
+        else hi = mid;
+      }
+      frameNum = lo;
+    }
+    frameNum = std::min(frameNum, (int32_t)s->seekCnt - 1);
+    showInfo("Playback seek to frame %u at %0.1f secs", frameNum, (float)s->seekIndex[frameNum].time / 1000.0);
+    s->frameCnt = frameNum;
+    seekPos = s->seekIndex[frameNum].offset;
+  }
+  return seekPos;
+}
+
+static uint32_t skipPosition(playSession* s, uint32_t* skipEnd) {
+  // for fast forward, get file position of header of frame step frames on from next frame, 
+  // or end of content if past last frame, or 0 if not known. skipEnd is set to end of that frame, 
+  // being start of the frame after it, or 0 if past last frame
+  *skipEnd = 0;
+  size_t aheadLen = 0;
+  for (int i = 0; i < s->blocksAhead; i++) aheadLen += s->blockLen[(s->sendBlock + 1 + i) % READ_AHEAD];
+  if (s->fileBlocks < s->blocksAhead + (s->remaining ? 1u : 0u)) return 0; // content to be sent is from previous segment
+  uint32_t nextPos = s->file.position() - aheadLen - (s->remaining ? s->buffLen - s->streamOffset : 0);
+  uint32_t seekPos = 0;
+  if (loadSeekIndex(s)) {
+    // find next frame from its position, skipping over frames using index without reading them
+    uint32_t lo = 0, hi = s->seekCnt;
+    while (lo < hi) {
+      uint32_t mid = (lo + hi) / 2;
+      if (s->seekIndex[mid].offset < nextPos) lo = mid + 1;
+      else hi = mid;
+    }
+    uint32_t frameNum = lo + s->step - 1;
+    if (frameNum < s->seekCnt) {
+      seekPos = s->seekIndex[frameNum].offset;
+      *skipEnd = frameNum + 1 < s->seekCnt ? s->seekIndex[frameNum + 1].offset : s->playbackEnd;
+      s->frameCnt = frameNum;
+      s->skipCnt += s->step - 1;
+    } else {
+      seekPos = s->playbackEnd; // continue with any next segment
+      s->skipCnt += s->seekCnt - lo;
+    }
   }
+  return seekPos;
+}
+
+static playSession* findSession(uint32_t sid, uint8_t state) {
+  // session with id in given state, else NULL
+  for (int i = 0; sid && i < maxSessions; i++) 
+    if (sessions[i].state == state && sessions[i].id == sid) return sessions + i;
+  return NULL;
+}
+
+static uint32_t selectPlayback(uint32_t sid, const char* fname, bool tail = false, bool playlist = false) {
+  // hold recording selected by browser tab in a session, until tab starts streaming with returned session id. 
+  // Tab keeps its id while it has a session, so that starting a new playback stops its previous one
+  static uint32_t lastId = 0;
+  xSemaphoreTake(sessionMutex, portMAX_DELAY);
+  if (!findSession(sid, SESSION_SELECTED) && !findSession(sid, SESSION_PLAYING)) {
+    // new id, as unknown to this boot
+    if (!++lastId) ++lastId;
+    sid = lastId;
+  }
+  playSession* s = findSession(sid, SESSION_SELECTED);
+  for (int i = 0; i < maxSessions && !s; i++) 
+    if (sessions[i].state == SESSION_FREE) s = sessions + i;
+  if (!s) {
+    // all in use, so replace oldest selection not streamed, eg by a closed tab
+    uint32_t now = millis();
+    for (int i = 0; i < maxSessions; i++) 
+      if (sessions[i].state == SESSION_SELECTED && (!s || now - sessions[i].selectTime > now - s->selectTime)) s = sessions + i;
+  }
+  // session buffers are allocated on first use then kept
+  if (s && !s->buffer) s->buffer = (uint8_t*)ps_malloc(sdBlockSize*READ_AHEAD);
+  if (s && s->buffer) {
+    strcpy(s->name, fname);
+    s->id = sid;
+    s->selectTime = millis();
+    s->seekFrameNum = s->seekMs = -1;
+    s->speed = 100;
+    s->step = 1;
+    s->tail = tail;
+    s->playlist = playlist;
+    s->state = SESSION_SELECTED;
+  } else {
+    showError("Playback refused - all %u sessions in use", maxSessions);
+    s = NULL;
+  }
+  xSemaphoreGive(sessionMutex);
+  return s ? sid : 0;
+}
+
+uint32_t selectTail(uint32_t sid) {
+  // browser tab to watch recording in progress when it starts streaming, returning session id or 0 if refused
+  return selectPlayback(sid, "live recording", true);
+}
+
+uint32_t selectFolder(uint32_t sid, const char* folder) {
+  // browser tab to play each recording in day folder back to back when it starts streaming, returning session id
+  std::string decodedName = std::regex_replace(std::string(folder), std::regex("%2F"), "/");
+  return selectPlayback(sid, decodedName.c_str(), false, true);
+}
+
+void seekPlayback(uint32_t sid, uint32_t target, bool byTime) {
+  // request tab's playback to continue from frame number or ms from start, actioned at next frame boundary
+  playSession* s = findSession(sid, SESSION_PLAYING);
+  if (!s) s = findSession(sid, SESSION_SELECTED);
+  if (!s) return;
+  if (byTime) s->seekMs = target;
+  else s->seekFrameNum = target;
+}
+
+uint32_t playbackSecs(uint32_t sid) {
+  // position in secs of frame last sent by tab's playback, in recording being sent, else 0
+  playSession* s = findSession(sid, SESSION_PLAYING);
+  return s ? (uint64_t)s->frameCnt * s->frameUs / 1000000 : 0;
+}
+
+void playbackSpeed(uint32_t sid, uint16_t speed) {
+  // set tab's playback speed, as % of recorded rate, taking effect from next frame
+  speed = std::min(std::max(speed, (uint16_t)MIN_SPEED), (uint16_t)MAX_SPEED);
+  playSession* s = findSession(sid, SESSION_PLAYING);
+  if (s) s->speed = speed;
+  s = findSession(sid, SESSION_SELECTED);
+  if (s) s->speed = speed;
+}
+
+void playbackStep(uint32_t sid, uint8_t step) {
+  // set tab's fast forward, sending one frame in step frames, taking effect from next frame
+  step = std::min(std::max(step, (uint8_t)1), (uint8_t)MAX_STEP);
+  playSession* s = findSession(sid, SESSION_PLAYING);
+  if (s) s->step = step;
+  s = findSession(sid, SESSION_SELECTED);
+  if (s) s->step = step;
+}
+
+static void waitStopped(uint32_t sid, bool allSessions) {
+  // wait till sessions stopped cleanly, but prevent infinite loop
+  uint32_t timeOut = millis();
+  bool playing = true;
+  while (playing && millis()-timeOut < 2000) {
+    playing = false;
+    for (int i = 0; i < maxSessions; i++) 
+      if (sessions[i].state == SESSION_PLAYING && sessions[i].stop && (allSessions || sessions[i].id == sid)) playing = true;
+    if (playing) delay(10);
+  }
+  if (playing) {
+    Serial.println();
+    showInfo("Failed to cleanly close playback");
+  }
+}
+
+void stopSession(uint32_t sid) {
+  // force stop any playback running for browser tab
+  playSession* s = findSession(sid, SESSION_PLAYING);
+  if (s) {
+    s->stop = true;
+    waitStopped(sid, false);
+  }
+}
+
+void stopPlaying() {
+  // force stop all currently running playbacks
+  bool playing = false;
+  for (int i = 0; i < maxSessions; i++) {
+    if (sessions[i].state == SESSION_PLAYING) {
+      sessions[i].stop = true;
+      playing = true;
+    }
+  }
+  if (playing) waitStopped(0, true);
+}
+
+static void fillAhead(playSession* s) {
+  // request playbackTask, shared by all sessions, to read into each free block of ring, except after 
+  // a fast forward skip, when only the frame to be sent is read, unless it runs on past its indexed end
+  if (s->readEnd && s->readPos >= s->readEnd && !s->blocksAhead) s->readEnd = 0;
+  while (s->blocksAhead < READ_AHEAD - 1 && (!s->readEnd || s->readPos < s->readEnd)) {
+    if (s->readEnd) s->readPos += sdBlockSize;
+    s->blocksAhead++;
+    xQueueSend(readQueue, &s, portMAX_DELAY);
+  }
+}
+
+static void drainAhead(playSession* s, bool discard) {
+  // wait for requested reads to complete, then discard ring content, or keep it to be sent
+  uint8_t blocks = s->blocksAhead;
+  for (int i = 0; i < blocks; i++) xSemaphoreTake(s->readSemaphore, portMAX_DELAY);
+  if (discard) {
+    s->blocksAhead = 0;
+    s->sendBlock = (s->fillBlock + READ_AHEAD - 1) % READ_AHEAD;
+  } else for (int i = 0; i < blocks; i++) xSemaphoreGive(s->readSemaphore);
+}
+
+static bool nextInFolder(const char* folder, const char* after, char* nextName) {
+  // first recording in folder named after given name, so in time order, else false
+  nextName[0] = 0;
+  File dir = SD_MMC.open(folder);
+  if (!dir || !dir.isDirectory()) return false;
+  for (File file = dir.openNextFile(); file; file = dir.openNextFile()) 
+    if (isRecording(file.name()) && strcmp(file.name(), after) > 0 
+      && (!nextName[0] || strcmp(file.name(), nextName) < 0)) strcpy(nextName, file.name());
+  return nextName[0];
+}
+
+static bool playFromMovi(File &fh, uint32_t* moviEnd) {
+  // position AVI file at its first chunk, and get end of chunks, so that idx1 and any trailer are not played
+  uint32_t moviStart;
+  if (aviMovi(fh, &moviStart, moviEnd) && fh.seek(moviStart, SeekSet)) return true;
+  showError("No movi list in %s", fh.name());
+  *moviEnd = 0;
+  return false;
+}
+
+playSession* startPlayback(uint32_t sid) {
+  // open recording selected by browser tab for streaming, or NULL if none selected
+  playSession* s = findSession(sid, SESSION_SELECTED);
+  if (!s) return NULL;
+  char fname[sizeof(s->name)];
+  strcpy(fname, s->name);
+  if (s->playlist && !nextInFolder(s->name, "", fname)) {
+    showError("Playback refused - no recordings in %s", s->name);
+    s->state = SESSION_FREE;
+    return NULL;
+  }
+  if (stopPlayback && !s->tail) {
+    showError("Playback refused - capture in progress");
+    s->state = SESSION_FREE;
+    return NULL;
+  }
+  if (s->tail && (!stopPlayback || (!tailBuffer && !(tailBuffer = (uint8_t*)ps_malloc(TAIL_BUFF))))) {
+    showError("Live recording refused - %s", stopPlayback ? "insufficient pSRAM" : "no capture in progress");
+    s->state = SESSION_FREE;
+    return NULL;
+  }
+  stopSession(sid); // in case already running
+  showInfo("Playing %s", s->name);
+  if (s->tail) {
+    // file is opened when its content is read, paced at recording rate
+    xSemaphoreTake(tailMutex, portMAX_DELAY);
+    s->tailGen = tail.gen;
+    tail.readers++;
+    xSemaphoreGive(tailMutex);
+    s->file = File();
+    s->fileAvi = recAvi;
+    s->tailPos = s->fileAvi ? AVI_HDR_LEN : 0;
+    s->vidSize = 0;
+    s->tailEnd = false;
+    s->recFPS = FPS;
+    s->recDuration = 0;
+    s->frameUs = 1000000 / std::max(FPS, (uint8_t)1);
+  } else {
+    s->file = SD_MMC.open(fname, FILE_READ);
+    s->fileAvi = isAviFile(fname);
+    if (s->fileAvi) playFromMovi(s->file, &s->playbackEnd);
+    else readIndexFooter(s->file, &s->playbackEnd); // exclude any frame index trailer from playback
+    s->vidSize = s->playbackEnd;
+    // extract meta data from filename, and pace at actual rate if indexed
+    int* meta = extractMeta(fname);
+    s->recFPS = meta[1];
+    s->recDuration = meta[2];
+    s->frameUs = indexedFrameUs(s->file);
+    if (!s->frameUs) s->frameUs = 1000000 / std::max(s->recFPS, (uint8_t)1);
+  }
+  s->fileFrameUs = s->frameUs;
+  s->nextFile = File();
+  s->nextChecked = false;
+  s->fileCnt = 1;
+  s->avi = s->fileAvi;
+  // mjpeg file starts with boundary, for AVI a boundary is sent first
+  if (s->avi) s->walker = {0, false, false, 0, {0}, true, false};
+  else s->walker = {streamBoundaryLen, false, false, 0, {0}, false, false}; 
+  s->remaining = s->atBoundary = s->stop = false;
+  s->frameCnt = s->sentCnt = s->skipCnt = s->fileBlocks = s->streamOffset = s->buffLen = s->underruns = 0;
+  s->rTimeTot = s->wTimeTot = s->fTimeTot = s->hTimeTot = s->tTimeTot = 0;
+  s->sTime = s->hTime = millis();
+  s->frameDue = micros();
+  s->state = SESSION_PLAYING;
+  // fill ring ready for first request
+  s->fillBlock = 0;
+  s->sendBlock = READ_AHEAD - 1;
+  s->blocksAhead = s->readEnd = 0;
+  s->priming = true;
+  fillAhead(s);
+  return s;
 }
 
 String getOldestDir() {
@@ -596,20 +1999,18 @@ String getOldestDir() {
   return oldName;
 }
 
-void listDir(const char* fname, char* htmlBuff) {
-  // either list day folders in root, or files in a day folder
+void listDir(const char* fname, char* htmlBuff, uint32_t sid) {
+  // either list day folders in root, or files in a day folder, or select recording for playback by tab with session id
   std::string decodedName(fname); 
   // need to decode encoded slashes
   decodedName = std::regex_replace(decodedName, std::regex("%2F"), "/");
   // check if folder or file
   bool noEntries = true;
   strcpy(htmlBuff, "{"); 
-  if (decodedName.find(MJPEGEXT) != std::string::npos) {
-    // mjpeg file selected
-    strcpy(mjpegName, decodedName.c_str());
-    doPlayback = true; // browser control
-    noEntries = true; 
-    strcpy(htmlBuff, "{}");                                                
+  if (isRecording(decodedName.c_str())) {
+    // recording selected, return session id for tab to stream it
+    sprintf(htmlBuff, "{\"sid\":%u}", selectPlayback(sid, decodedName.c_str()));
+    return;
   } else {
     strcpy(dayFolder, decodedName.c_str());
     bool returnDirs = (decodedName.compare("/")) ? false : true;
@@ -632,7 +2033,7 @@ void listDir(const char* fname, char* htmlBuff) {
           sprintf(optionHtml, "\"%s\":\"%s\",", file.name(), file.name());
           if (strlen(htmlBuff)+strlen(optionHtml) < htmlBuffLen) strcat(htmlBuff, optionHtml);
           else {
-            showError("Too many folders to list %u+%u in %u bytes", strlen(htmlBuff), strlen(optionHtml), htmlBuffLen);
+            showError("Too many folders to list %zu+%zu in %zu bytes", strlen(htmlBuff), strlen(optionHtml), htmlBuffLen);
             break;
           }
           noEntries = false;
@@ -640,12 +2041,11 @@ void listDir(const char* fname, char* htmlBuff) {
       }
       if (!file.isDirectory() && !returnDirs) {
         // update existing html with file details
-        std::string str(file.name());
-        if (str.find(MJPEGEXT) != std::string::npos) {
+        if (isRecording(file.name())) {
           sprintf(optionHtml, "\"%s\":\"%s %0.1fMB\",", file.name(), file.name(), (float)file.size()/ONEMEG);
           if (strlen(htmlBuff)+strlen(optionHtml) < htmlBuffLen) strcat(htmlBuff, optionHtml);
           else {
-            showError("Too many files to list %u+%u in %u bytes", strlen(htmlBuff), strlen(optionHtml), htmlBuffLen);
+            showError("Too many files to list %zu+%zu in %zu bytes", strlen(htmlBuff), strlen(optionHtml), htmlBuffLen);
             break;
           }
           noEntries = false;
@@ -659,171 +2059,393 @@ void listDir(const char* fname, char* htmlBuff) {
 }
 
 size_t isSubArray(uint8_t* haystack, uint8_t* needle, size_t hSize, size_t nSize) { 
-  // find a subarray (needle) in another array (haystack)
-  size_t h = 0, n = 0; // Two pointers to traverse the arrays 
-  // Traverse both arrays simultaneously 
-  while (h < hSize && n < nSize) { 
-    // If element matches, increment both pointers 
-    if (haystack[h] == needle[n]) { 
-      h++; 
-      n++; 
-      // If needle is completely traversed 
-      if (n == nSize) return h; // position of end of needle
-    } else { 
-      // if not, increment h and reset n 
-      h = h - n + 1; 
-      n = 0; 
-    } 
-  } 
+  // find a subarray (needle) in another array (haystack), returning position of end of needle, or 0 if not found.
+  // Horspool search, skipping ahead by distance of last compared byte from end of needle
+  if (!nSize || nSize > hSize) return 0;
+  uint16_t skip[256];
+  for (int i = 0; i < 256; i++) skip[i] = nSize;
+  for (size_t n = 0; n < nSize - 1; n++) skip[needle[n]] = nSize - 1 - n;
+  for (size_t h = 0; h <= hSize - nSize; h += skip[haystack[h + nSize - 1]]) 
+    if (!memcmp(haystack + h, needle, nSize)) return h + nSize;
   return 0; // not found
 } 
 
-void readSD() {
-  // read next cluster from SD for playback
+static size_t walkFrame(frameWalker* walker, const uint8_t* buff, size_t buffLen, bool* frameEnd) {
+  // return length of content in buffer up to end of boundary after next frame, using frame content length,
+  // else whole buffer if frame continues into next buffer. Boundary is searched for if frame headers corrupt
+  *frameEnd = false;
+  if (!buffLen) return 0;
+  if (!walker->toBoundary && !walker->resync) {
+    // get part header, which may be split across buffers
+    size_t hLen = std::min(partHdrLen - walker->hdrHave, buffLen);
+    memcpy(walker->hdr + walker->hdrHave, buff, hLen);
+    walker->hdrHave += hLen;
+    if (walker->hdrHave < partHdrLen) return buffLen; // rest of header in next buffer
+    walker->hdrHave = 0;
+    walker->inFrame = true;
+    if (memcmp(walker->hdr, _STREAM_PART, partPrefixLen)) walker->resync = true;
+    else walker->toBoundary = hLen + strtoul(walker->hdr + partPrefixLen, NULL, 10) + streamBoundaryLen;
+  }
+  if (walker->toBoundary) {
+    if (walker->toBoundary > buffLen) {
+      walker->toBoundary -= buffLen;
+      return buffLen;
+    }
+    size_t frameLen = walker->toBoundary;
+    walker->toBoundary = 0;
+    // check boundary if wholly in this buffer
+    if (frameLen < streamBoundaryLen || !memcmp(buff + frameLen - streamBoundaryLen, _STREAM_BOUNDARY, streamBoundaryLen)) {
+      *frameEnd = walker->inFrame;
+      walker->inFrame = false;
+      return frameLen;
+    }
+    walker->resync = true;
+  }
+  // corrupt frame, search for next boundary
+  size_t boundary = isSubArray((uint8_t*)buff, (uint8_t*)needle, buffLen, streamBoundaryLen);
+  if (!boundary) return buffLen;
+  showDebug("Resynced on frame boundary");
+  walker->resync = walker->inFrame = false;
+  *frameEnd = true;
+  return boundary;
+}
+
+static const uint8_t* walkAvi(frameWalker* walker, const uint8_t* buff, size_t buffLen, size_t* used, size_t* len, bool* frameEnd) {
+  // return next content of AVI file as mjpeg stream, being a generated boundary or part header, or a 
+  // jpeg in place, with length in len, and set used to buffer length walked over. Chunks other than 
+  // jpegs are walked over with len 0, as is a chunk header split across buffers
+  *used = *len = 0;
+  *frameEnd = false;
+  if (walker->boundaryDue) {
+    walker->boundaryDue = false;
+    *len = streamBoundaryLen;
+    *frameEnd = walker->inFrame;
+    walker->inFrame = false;
+    return (const uint8_t*)_STREAM_BOUNDARY;
+  }
+  if (!buffLen) return NULL;
+  if (walker->toBoundary) {
+    // rest of chunk, or as much as is in buffer
+    *used = std::min(walker->toBoundary, buffLen);
+    walker->toBoundary -= *used;
+    if (walker->skip) return NULL;
+    *len = *used;
+    walker->boundaryDue = !walker->toBoundary;
+    return buff;
+  }
+  // get chunk header, which may be split across buffers
+  *used = std::min(AVI_CHUNK_HDR - walker->hdrHave, buffLen);
+  memcpy(walker->hdr + walker->hdrHave, buff, *used);
+  walker->hdrHave += *used;
+  if (walker->hdrHave < AVI_CHUNK_HDR) return NULL;
+  walker->hdrHave = 0;
+  uint8_t* hdr = (uint8_t*)walker->hdr;
+  uint32_t chunkLen = hdr[4] | hdr[5] << 8 | hdr[6] << 16 | (uint32_t)hdr[7] << 24;
+  walker->skip = memcmp(hdr, "00dc", 4);
+  walker->toBoundary = chunkLen + (chunkLen & 1); // chunks are word aligned
+  if (!memcmp(hdr, "RIFF", 4) || !memcmp(hdr, "LIST", 4)) walker->toBoundary = 4; // step into OpenDML AVIX RIFF and its movi list
+  if (walker->skip) return NULL;
+  walker->inFrame = true;
+  walker->boundaryDue = !chunkLen;
+  *len = snprintf(walker->hdr, PART_BUF_LEN, _STREAM_PART, chunkLen);
+  return (const uint8_t*)walker->hdr;
+}
+
+static bool nextSegment(File &fh, char* nextName) {
+  // name of next segment of recording, else false
+  segmentInfo seg;
+  if (!readSegmentInfo(fh, &seg) || !seg.nextBase[0]) return false;
+  char folder[BASE_NAME_LEN];
+  strcpy(folder, seg.nextBase);
+  char* slash = strrchr(folder, '/');
+  if (!slash) {
+    showError("Invalid next segment %s", seg.nextBase); // eg corrupt segment chain
+    return false;
+  }
+  *slash = 0;
+  size_t baseLen = strlen(seg.nextBase);
+  File dir = SD_MMC.open(folder);
+  for (File file = dir.openNextFile(); file; file = dir.openNextFile()) {
+    // next segment name starts with its base name
+    if (!strncmp(file.name(), seg.nextBase, baseLen) && file.name()[baseLen] == '_' && isRecording(file.name())) {
+      strcpy(nextName, file.name());
+      return true;
+    }
+  }
+  showError("Next segment %s not found", seg.nextBase);
+  return false;
+}
+
+static void openNextPlay(playSession* s) {
+  // near end of file, open file that playback continues with, being next segment of recording,
+  // or for playlist next recording in folder, so that it is ready without a gap at end of file
+  char nextName[sizeof(s->name)];
+  s->nextChecked = true;
+  uint32_t filePos = s->file.position();
+  bool haveNext = s->playlist ? nextInFolder(s->name, s->file.name(), nextName) : nextSegment(s->file, nextName);
+  s->file.seek(filePos, SeekSet);
+  if (!haveNext) return;
+  s->nextFile = SD_MMC.open(nextName, FILE_READ);
+  if (!s->nextFile) return;
+  s->nextFrameUs = indexedFrameUs(s->nextFile);
+  if (!s->nextFrameUs) s->nextFrameUs = 1000000 / std::max(extractMeta(nextName)[1], 1);
+  s->nextAvi = isAviFile(nextName);
+  if (s->nextAvi) {
+    if (!playFromMovi(s->nextFile, &s->nextEnd)) s->nextFile.close();
+  } else {
+    readIndexFooter(s->nextFile, &s->nextEnd);
+    // skip leading boundary, as previous file ended with one
+    if (!s->nextFile.seek(streamBoundaryLen, SeekSet)) s->nextFile.close();
+  }
+}
+
+static bool playNextFile(playSession* s) {
+  // at end of file, continue playback with file opened in advance
+  if (!s->nextChecked) openNextPlay(s);
+  if (!s->nextFile) return false;
+  showInfo("Playback continues with %s", s->nextFile.name());
+  s->file.close();
+  s->file = s->nextFile;
+  s->nextFile = File();
+  s->nextChecked = false;
+  s->fileBlocks = 0;
+  s->playbackEnd = s->nextEnd;
+  s->vidSize += s->nextEnd;
+  s->fileFrameUs = s->nextFrameUs;
+  s->fileAvi = s->nextAvi;
+  int* meta = extractMeta(s->file.name());
+  s->recFPS = meta[1];
+  s->recDuration += meta[2];
+  s->fileCnt++;
+  return true;
+}
+
+static size_t readTail(playSession* s, uint8_t* block) {
+  // read next content of recording in progress, from SD if synced, else from writerTask's copy.
+  // Returns 0 if caught up with writerTask, or at end of recording with tailEnd set
+  size_t readLen = 0;
+  char name[sizeof(tail.name)];
+  xSemaphoreTake(tailMutex, portMAX_DELAY);
+  if (s->tailGen + 1 == tail.gen && tail.rolled && s->tailPos >= tail.endLen) {
+    // finished segment sent, continue with next, skipping leading boundary as previous segment ended with one,
+    // or AVI header
+    s->tailGen++;
+    s->tailPos = s->fileAvi ? AVI_HDR_LEN : streamBoundaryLen;
+    s->file.close();
+  }
+  bool finished = s->tailGen != tail.gen; // all of file now on SD
+  bool rolled = tail.rolled;
+  if (finished && (s->tailGen + 1 != tail.gen || !tail.endName[0])) s->tailEnd = true; // missed or discarded
+  uint32_t synced = finished ? tail.endLen : tail.synced;
+  uint32_t end = finished ? tail.endLen : tail.synced + tail.len;
+  if (!finished && tail.end) end = std::min(end, tail.end);
+  synced = std::min(synced, end);
+  strcpy(name, finished ? tail.endName : tail.name);
+  if (!s->tailEnd && s->tailPos >= synced && s->tailPos < end) {
+    // from copy of content not yet synced
+    readLen = std::min((size_t)(end - s->tailPos), sdBlockSize);
+    memcpy(block, tailBuffer + s->tailPos - synced, readLen);
+  } 
+  xSemaphoreGive(tailMutex);
+  if (!s->tailEnd && s->tailPos < synced && name[0]) {
+    // from SD, reopening file if synced since opened
+    if (!s->file || s->tailPos >= s->file.size()) {
+      s->file.close();
+      s->file = SD_MMC.open(name, FILE_READ);
+    }
+    // read directly to psram, as iSDbuffer is in use by writerTask
+    if (s->file && s->file.seek(s->tailPos, SeekSet)) 
+      readLen = s->file.read(block, std::min((size_t)(synced - s->tailPos), sdBlockSize));
+  }
+  if (finished && !rolled && !readLen && s->tailPos >= end) s->tailEnd = true;
+  s->tailPos += readLen;
+  s->vidSize += readLen;
+  return readLen;
+}
+
+static void readSD(playSession* s, uint8_t* readBuf) {
+  // read next cluster from SD into session's next free ring block
   uint32_t rTime = millis();
-  readLen = 0;
-  if (!stopPlayback) {
-    // read to interim dram before copying to psram
-    readLen = playbackFile.read(iSDbuffer, RAMSIZE);
-    memcpy(SDbuffer+RAMSIZE*2, iSDbuffer, RAMSIZE);
+  size_t readLen = 0;
+  uint8_t* block = s->buffer + s->fillBlock * sdBlockSize;
+  if (s->tail) {
+    if (!s->stop) readLen = readTail(s, block);
+  } else if (!stopPlayback && !s->stop) {
+    // read to playbackTask's own interim dram before copying to psram, else directly to psram, 
+    // only up to end of frame to be sent after fast forward skip
+    uint8_t* readTo = readBuf ? readBuf : block;
+    uint32_t readEnd = s->readEnd ? s->readEnd : s->playbackEnd;
+    readLen = s->file.read(readTo, std::min(sdBlockSize, (size_t)(readEnd - s->file.position())));
+    if (!readLen && !s->readEnd && playNextFile(s)) 
+      readLen = s->file.read(readTo, std::min(sdBlockSize, (size_t)(s->playbackEnd - s->file.position())));
+    if (readBuf) memcpy(block, readBuf, readLen);
+    if (readLen) s->fileBlocks++;
+    if (!s->nextChecked && s->playbackEnd - s->file.position() <= READ_AHEAD * sdBlockSize) openNextPlay(s);
   }
+  s->blockLen[s->fillBlock] = readLen;
+  s->blockFrameUs[s->fillBlock] = s->fileFrameUs;
+  s->blockAvi[s->fillBlock] = s->fileAvi;
+  s->tailBlockEnd[s->fillBlock] = s->tail && s->tailEnd;
+  s->fillBlock = (s->fillBlock + 1) % READ_AHEAD;
   showDebug("SD read time %lu ms", millis() - rTime);
-  wTimeTot += millis() - rTime;
-  xSemaphoreGive(readSemaphore); // signal that ready     
-  delay(10);                     
-}
-
-size_t* getNextFrame() {
-  // get next cluster on demand when ready for opened mjpeg
-  static bool remaining;
-  static size_t streamOffset;
-  static size_t boundary;
-  static size_t imgPtrs[2];
-  static uint32_t hTimeTot;
-  static uint32_t tTimeTot;
-  static uint32_t hTime;
-  static size_t buffLen;
-  static uint16_t skipOver;
-  if (firstCallPlay) {
-    sTime = millis();
-    hTime = millis();
-    firstCallPlay = false;
-    remaining = false;
-    frameCnt = boundary = streamOffset = 0;
-    wTimeTot = fTimeTot = hTimeTot = tTimeTot = 0;
-    skipOver = 200; // skip over first boundary
-    buffLen = readLen;
-  }  
-  
-  showDebug("http send time %lu ms", millis() - hTime);
-  hTimeTot += millis() - hTime;
+  s->rTimeTot += millis() - rTime;
+  xSemaphoreGive(s->readSemaphore); // signal that ready     
+}
+
+static void paceFrame(playSession* s) {
+  // wait till frame due at recorded rate adjusted for speed, restarting from now if more than a frame late
+  uint32_t frameUs = (uint64_t)s->frameUs * 100 / s->speed;
+  uint32_t now = micros();
+  int32_t early = s->frameDue - now;
+  if (early > 0) delay((early + 500) / 1000);
+  else if (-early > (int32_t)frameUs) s->frameDue = now;
+  s->frameDue += frameUs;
+}
+
+const uint8_t* getNextFrame(playSession* s, size_t* frameLen) {
+  // get next frame of session's recording, paced at recorded rate, or remainder of cluster 
+  // if frame continues in next cluster. Returns NULL when finished
+  showDebug("http send time %lu ms", millis() - s->hTime);
+  s->hTimeTot += millis() - s->hTime;
+  *frameLen = 0;
+  if ((stopPlayback && !s->tail) || s->stop) return NULL;
   uint32_t mTime = millis();
-  if (buffLen && !stopPlayback) {
-    if (!remaining) {
+  bool seeking = s->seekFrameNum >= 0 || s->seekMs >= 0;
+  if (s->atBoundary && !s->tail && (seeking || s->step > 1)) {
+    // discard content already read, and continue from header of requested frame, 
+    // or of frame after those skipped by fast forward
+    drainAhead(s, false); // wait for any read ahead to complete
+    size_t filePos = s->file.position();
+    uint32_t skipEnd = 0;
+    uint32_t seekPos = seeking ? seekPosition(s) : skipPosition(s, &skipEnd);
+    if (seekPos) {
+      drainAhead(s, true);
+      s->file.seek(seekPos, SeekSet);
+      s->remaining = false;
+      s->streamOffset = 0;
+      s->walker = {0, false, false, 0, {0}, false, false}; // at header, or AVI chunk, of requested frame
+      if (seeking) s->frameDue = micros();
+      // fast forward reads just the frame to be sent, as the next is likely beyond a full ring
+      s->readEnd = skipEnd;
+      s->readPos = seekPos;
+      s->priming = true;
+      fillAhead(s);
+    } else s->file.seek(filePos, SeekSet); // carry on from where read ahead left off
+    s->wTimeTot += millis() - mTime;
+  }
+  size_t len = 0;
+  bool frameEnd = false;
+  const uint8_t* content;
+  do {
+    while (!s->remaining && !s->walker.boundaryDue) {
+      // block sent, so can be read into again, then send from next block when read from SD card
+      fillAhead(s);
       mTime = millis(); 
-      xSemaphoreTake(readSemaphore, portMAX_DELAY); // wait for read from SD card completed
+      if (xSemaphoreTake(s->readSemaphore, 0) != pdTRUE) {
+        if (!s->priming && !s->tail) s->underruns++;
+        xSemaphoreTake(s->readSemaphore, portMAX_DELAY);
+      }
+      s->priming = false;
+      s->blocksAhead--;
+      s->sendBlock = (s->sendBlock + 1) % READ_AHEAD;
       showDebug("SD wait time %lu ms", millis()-mTime);
-      wTimeTot += millis()-mTime;
-      mTime = millis();                                 
-      memcpy(SDbuffer, SDbuffer+RAMSIZE*2, readLen); // load new cluster from double buffer
-      showDebug("memcpy took %lu ms for %u bytes", millis()-mTime, readLen);
-      buffLen = readLen;
-      fTimeTot += millis()-mTime;                                 
-      remaining = true; 
-      xTaskNotifyGive(playbackHandle); // wake up task to get next cluster - sets readLen
+      s->wTimeTot += millis()-mTime;
+      s->buffLen = s->blockLen[s->sendBlock];
+      if (s->buffLen) {
+        s->buff = s->buffer + s->sendBlock * sdBlockSize;
+        s->frameUs = s->blockFrameUs[s->sendBlock]; // next file may differ in frame rate
+        s->avi = s->blockAvi[s->sendBlock]; // or in format
+        s->remaining = true; 
+      } else if (!s->tail || s->tailBlockEnd[s->sendBlock] || s->stop) return NULL; // end of recording
+      else delay(TAIL_WAIT); // caught up with recording in progress
     }
     mTime = millis();
-    if (streamOffset+skipOver > buffLen) {
-      showError("streamOffset %u + skipOver %u > buffLen %u", streamOffset, skipOver, buffLen);
-      stopPlayback = true;
-    
+    if (s->avi) {
+      // convert next chunk content to stream content
+      size_t used;
+      content = walkAvi(&s->walker, s->buff + s->streamOffset, s->remaining ? s->buffLen - s->streamOffset : 0, &used, &len, &frameEnd);
+      s->streamOffset += used;
     } else {
-      // search for next boundary in buffer
-      boundary = isSubArray(SDbuffer+streamOffset+skipOver, (uint8_t*)needle, buffLen-streamOffset-skipOver, streamBoundaryLen);
-      skipOver = 0;
-      showDebug("frame search time %lu ms", millis()-mTime);
-      fTimeTot += millis()-mTime;
-      if (boundary) {
-        // found image boundary
-        mTime = millis();
-        // wait on playbackSemaphore for rate control
-        xSemaphoreTake(playbackSemaphore, portMAX_DELAY);
-        showDebug("frame timer wait %lu ms", millis()-mTime);
-        tTimeTot += millis()-mTime;
-        frameCnt++;
-        showProgress();
-        imgPtrs[0] = boundary; // amount to send
-        imgPtrs[1] = streamOffset; // from here
-        streamOffset += boundary;
-        if (streamOffset >= buffLen) remaining = false;     
-      } else {
-        // no (more) complete images in buffer
-        imgPtrs[0] = buffLen - streamOffset; // remainder of buffer
-        imgPtrs[1] = streamOffset;
-        remaining = false;
-      } 
+      // walk to end of next frame in buffer
+      content = s->buff + s->streamOffset;
+      while (!frameEnd && s->streamOffset + len < s->buffLen) 
+        len += walkFrame(&s->walker, s->buff + s->streamOffset + len, s->buffLen - s->streamOffset - len, &frameEnd);
+      s->streamOffset += len;
     }
-    if (!remaining) streamOffset = 0; // load next cluster from SD in parallel
-  } 
-  
-  if ((!buffLen && !remaining) || stopPlayback) {     
-    // finished, close SD file used for streaming  
-    playbackFile.close(); 
-    imgPtrs[0] = 0; 
-    imgPtrs[1] = 0;
-    if (stopPlayback) showInfo("Force close playback");
-    else {
-      uint32_t playDuration = (millis()-sTime)/1000;
-      uint32_t totBusy = wTimeTot+fTimeTot+hTimeTot;
-      showInfo("\n******** MJPEG playback stats ********");
-      showInfo("Playback %s", mjpegName);
-      showInfo("Recorded FPS %u, duration %u secs", recFPS, recDuration);
-      showInfo("Playback FPS %0.1f, duration %u secs", (float)frameCnt/playDuration, playDuration);
-      showInfo("Number of frames: %u", frameCnt);
-      showInfo("Average SD read speed: %u kB/s", ((vidSize / wTimeTot) * 1000) / 1024);
-      if (frameCnt) {
-        showInfo("Average frame SD read time: %u ms", wTimeTot / frameCnt);
-        showInfo("Average frame processing time: %u ms", fTimeTot / frameCnt);
-        showInfo("Average frame delay time: %u ms", tTimeTot / frameCnt);
-        showInfo("Average http send time: %u ms", hTimeTot / frameCnt);
-        showInfo("Busy: %u%%", std::min(100 * totBusy/(totBusy+tTimeTot),(uint32_t)100));
-      }
-      showInfo("Free heap: %u, free pSRAM %u", ESP.getFreeHeap(), ESP.getFreePsram());
-      showInfo("*************************************\n");
+    if (s->remaining && s->streamOffset >= s->buffLen) {
+      s->remaining = false;
+      s->streamOffset = 0; 
     }
-    setFPS(saveFPS); // realign with browser
-    stopPlayback = false;
-    isPlaying = false;
+    s->atBoundary = frameEnd;
+    showDebug("frame search time %lu ms", millis()-mTime);
+    s->fTimeTot += millis()-mTime;
+  } while (!len);
+  if (frameEnd) {
+    // found image boundary, wait for rate control
+    mTime = millis();
+    paceFrame(s);
+    showDebug("frame pacing wait %lu ms", millis()-mTime);
+    s->tTimeTot += millis()-mTime;
+    s->frameCnt++;
+    s->sentCnt++;
+    showProgress();
   }
-  hTime = millis();
-  return imgPtrs;
+  // send frame, or remainder of buffer if no (more) complete images in buffer
+  *frameLen = len;
+  s->hTime = millis();
+  return content;
 }
 
-void stopPlaying() {
-  if (isPlaying) {
-    // force stop any currently running playback
-    stopPlayback = true;
-    // wait till stopped cleanly, but prevent infinite loop
-    uint32_t timeOut = millis();
-    while (isPlaying && millis()-timeOut < 2000) delay(10); 
-    if (isPlaying) {
-      Serial.println();
-      showInfo("Failed to cleanly close playback");
-      doPlayback = false;
-      setFPS(saveFPS);
-      xSemaphoreGive(playbackSemaphore);
-      xSemaphoreGive(readSemaphore);
-      delay(200);
-    }
-    stopPlayback = false;
-    isPlaying = false;
-  } 
+void endPlayback(playSession* s) {
+  // finished streaming, close SD file used and free session
+  drainAhead(s, true); // let any read ahead complete
+  s->file.close(); 
+  s->nextFile.close();
+  if (s->tail) {
+    xSemaphoreTake(tailMutex, portMAX_DELAY);
+    tail.readers--;
+    xSemaphoreGive(tailMutex);
+  }
+  if ((stopPlayback && !s->tail) || s->stop) showInfo("Force close playback of %s", s->name);
+  else {
+    uint32_t playDuration = millis()-s->sTime;
+    uint32_t totBusy = s->wTimeTot+s->fTimeTot+s->hTimeTot;
+    showInfo("\n******** MJPEG playback stats ********");
+    showInfo("Playback %s", s->name);
+    if (s->fileCnt > 1) showInfo("Files played: %u", s->fileCnt);
+    showInfo("Recorded FPS %u, duration %u secs", s->recFPS, s->recDuration);
+    showInfo("Playback speed %u%%, sending 1 in %u frames", s->speed, s->step);
+    showInfo("Playback FPS %0.1f, duration %u secs", (float)s->sentCnt*1000/std::max(playDuration, (uint32_t)1), playDuration/1000);
+    showInfo("Number of frames: %u, skipped %u", s->sentCnt, s->skipCnt);
+    showInfo("Average SD read speed: %u kB/s", ((s->vidSize / std::max(s->rTimeTot, (uint32_t)1)) * 1000) / 1024);
+    showInfo("Read ahead of %u blocks of %zu bytes, underruns: %u", READ_AHEAD, sdBlockSize, s->underruns);
+    if (s->sentCnt) {
+      showInfo("Average frame SD read time: %u ms", s->rTimeTot / s->sentCnt);
+      showInfo("Average frame SD wait time: %u ms", s->wTimeTot / s->sentCnt);
+      showInfo("Average frame processing time: %u ms", s->fTimeTot / s->sentCnt);
+      showInfo("Average frame delay time: %u ms", s->tTimeTot / s->sentCnt);
+      showInfo("Average http send time: %u ms", s->hTimeTot / s->sentCnt);
+      showInfo("Busy: %u%%", std::min(100 * totBusy/std::max(totBusy+s->tTimeTot, (uint32_t)1),(uint32_t)100));
+    }
+    showInfo("Free heap: %u, free pSRAM %u", ESP.getFreeHeap(), ESP.getFreePsram());
+    showInfo("*************************************\n");
+  }
+  // seek index is reloaded on next seek, so not held by idle sessions
+  free(s->seekIndex);
+  s->seekIndex = NULL;
+  s->seekCnt = 0;
+  s->state = SESSION_FREE;
 }
 
-static void playbackTask(void* parameter) {
+static void playbackTask(void*) {
+  // read ahead next cluster for each playback session in turn
+  // using own dma capable buffer, as iSDbuffer is in use by writerTask while recording
+  playSession* s;
+  playBuffer = (uint8_t*)heap_caps_malloc(sdBlockSize, MALLOC_CAP_DMA);
+  if (!playBuffer) showError("Insufficient memory for playback read block, reading to psram");
   while (true) {
-    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
-    readSD();
+    xQueueReceive(readQueue, &s, portMAX_DELAY);
+    readSD(s, playBuffer);
   }
   vTaskDelete(NULL);
 }
@@ -843,10 +2465,65 @@ static void infoSD() {
     cardSize = SD_MMC.cardSize() / ONEMEG;
     totBytes = SD_MMC.totalBytes() / ONEMEG;
     useBytes = SD_MMC.usedBytes() / ONEMEG;
-    showInfo("SD card type %s, Size: %lluMB, Used space: %lluMB, Total space: %lluMB", 
+    showInfo("SD card type %s, Size: %" PRIu64 "MB, Used space: %" PRIu64 "MB, Total space: %" PRIu64 "MB", 
       typeStr, cardSize, useBytes, totBytes);
   } 
 }
+static size_t calibrateSD() {
+  // time sustained writes to a scratch file for each write size, to find fastest for this card
+  const char* calibFile = "/calib.tmp";
+  size_t bestSize = RAMSIZE;
+  uint32_t bestTime = UINT32_MAX;
+  memset(iSDbuffer, 0, MAX_SD_BLOCK);
+  for (size_t blockSize = RAMSIZE; blockSize <= MAX_SD_BLOCK; blockSize *= 2) {
+    File calib = SD_MMC.open(calibFile, FILE_WRITE);
+    if (!calib) break;
+    uint32_t tTime = millis();
+    for (size_t written = 0; written < CALIB_BYTES; written += blockSize) calib.write(iSDbuffer, blockSize);
+    calib.close();
+    tTime = std::max(millis() - tTime, 1UL);
+    SD_MMC.remove(calibFile);
+    showInfo("SD write size %zu bytes: %u kB/s", blockSize, (CALIB_BYTES / 1024 * 1000) / tTime);
+    if (tTime < bestTime) {
+      bestTime = tTime;
+      bestSize = blockSize;
+    }
+  }
+  return bestSize;
+}
+
+static bool prepSDblock() {
+  // obtain SD write size for this card, calibrating if not already done, then allocate block
+  Preferences sdPref;
+  uint32_t cardMB = SD_MMC.cardSize() / ONEMEG; // identifies card
+  if (iSDbuffer) free(iSDbuffer);
+  iSDbuffer = NULL;
+  sdBlockSize = RAMSIZE;
+  if (SD_CALIBRATE && sdPref.begin("sdcard", false)) {
+    size_t savedSize = sdPref.getUInt("blockSize", 0);
+    if (sdPref.getUInt("cardMB", 0) == cardMB && savedSize >= RAMSIZE && savedSize <= MAX_SD_BLOCK) sdBlockSize = savedSize;
+    else {
+      iSDbuffer = (uint8_t*)heap_caps_malloc(MAX_SD_BLOCK, MALLOC_CAP_DMA);
+      if (iSDbuffer) {
+        showInfo("Calibrating SD write size ...");
+        sdBlockSize = calibrateSD();
+        free(iSDbuffer);
+        iSDbuffer = NULL;
+        sdPref.putUInt("cardMB", cardMB);
+        sdPref.putUInt("blockSize", sdBlockSize);
+      } else showError("Insufficient memory to calibrate SD write size");
+    }
+    sdPref.end();
+  }
+  iSDbuffer = (uint8_t*)heap_caps_malloc(sdBlockSize, MALLOC_CAP_DMA);
+  if (!iSDbuffer) {
+    showError("Insufficient memory for SD write size %zu", sdBlockSize);
+    return false;
+  }
+  showInfo("SD write size %zu bytes", sdBlockSize);
+  return true;
+}
+
 bool sdPrepared = false;
 bool prepSD_MMC() {
   /* open SD card in required mode: MMC 1 bit (1), MMC 4 bit (4)
@@ -866,8 +2543,10 @@ bool prepSD_MMC() {
   if (res){ 
     showInfo("SD ready in %s mode ", ONELINE ? "1-line" : "4-line");
     infoSD();
-    sdPrepared=true;
-    return true;
+    // remove any AVI index spilled by a conversion interrupted by restart
+    if (SD_MMC.exists(AVI_IDX_FILE)) SD_MMC.remove(AVI_IDX_FILE);
+    sdPrepared = prepSDblock();
+    return sdPrepared;
   } else {
     showError("SD mount failed for %s mode", ONELINE ? "1-line" : "4-line");
     sdPrepared=false;
@@ -883,7 +2562,7 @@ void deleteFolderOrFile(const char * val) {
     showError("Failed to open %s", val);    
     return;
   }
-  stopPlayback = true;
+  stopPlaying();
   //Empty directory first
   if (f.isDirectory()){
     showInfo("Directory %s contents", val);
@@ -914,7 +2593,12 @@ void deleteFolderOrFile(const char * val) {
     }  
     
   }else{  
-    //Remove the file
+    //Remove the file, and any thumbnail
+    if (isRecording(val)) {
+      char thumb[100];
+      thumbName(thumb, val, sizeof(thumb));
+      SD_MMC.remove(thumb);
+    }
     if(SD_MMC.remove(val)){
        showInfo("File %s deleted", val);
     } else {
@@ -931,17 +2615,28 @@ bool prepMjpeg() {
     if (sdPrepared) { 
       if (ONELINE) controlLamp(false); // set lamp fully off as sd_mmc library still initialises pin 4
       getLocalNTP(); // get time from NTP
-      SDbuffer = (uint8_t*)ps_malloc(MAX_JPEG); // buffer frame to store in SD
+      queueBuffer = (uint8_t*)ps_malloc(FRAME_QUEUE_SIZE); // frame queue to store in SD
+      if (FRAME_INDEX) frameIndex = (frameIndexEntry*)ps_malloc(MAX_FRAMES * sizeof(frameIndexEntry));
       htmlBuff = (char*)ps_malloc(htmlBuffLen); 
       if (USE_PIR) {
         PIRpin = (ONELINE) ? 12 : 33;
         pinMode(PIRpin, INPUT_PULLDOWN); // pulled high for active
       }
       pinMode(LAMPpin, OUTPUT);
-      readSemaphore = xSemaphoreCreateBinary();
-      playbackSemaphore = xSemaphoreCreateBinary();
+      // playback sessions, as many as buffers fit in budget
+      maxSessions = std::min((size_t)MAX_SESSIONS, (size_t)PLAYBACK_PSRAM / (sdBlockSize*READ_AHEAD));
+      for (int i = 0; i < maxSessions; i++) sessions[i].readSemaphore = xSemaphoreCreateCounting(READ_AHEAD, 0);
+      readQueue = xQueueCreate(MAX_SESSIONS * READ_AHEAD, sizeof(playSession*));
+      sessionMutex = xSemaphoreCreateMutex();
+      tailMutex = xSemaphoreCreateMutex();
       frameMutex = xSemaphoreCreateMutex();
       motionMutex = xSemaphoreCreateMutex();
+      decodeMutex = xSemaphoreCreateMutex();
+      thumbQueue = xQueueCreate(THUMB_QUEUE_LEN, sizeof(thumbItem));
+      aviMutex = xSemaphoreCreateMutex();
+      flushSemaphore = xSemaphoreCreateBinary();
+      frameQueue = xQueueCreate(FRAME_QUEUE_LEN, sizeof(queueItem));
+      if (fbCount > FB_SPARE) fbSemaphore = xSemaphoreCreateCounting(fbCount - FB_SPARE, fbCount - FB_SPARE);
       if (!esp_camera_fb_get()) return false; // test & prime camera
       showInfo("Sound recording is %s", useMicrophone() ? "On" : "Off");
       showInfo("\nTo record new MJPEG, do one of:");
@@ -963,6 +2658,8 @@ bool prepMjpeg() {
 void startSDtasks() {
   // tasks to manage SD card operation
   xTaskCreate(&captureTask, "captureTask", 4096, NULL, 5, &captureHandle);
+  xTaskCreate(&writerTask, "writerTask", 4096, NULL, 4, &writerHandle);
+  xTaskCreate(&thumbTask, "thumbTask", 4096, NULL, 1, &thumbHandle);
   if (xTaskCreate(&playbackTask, "playbackTask", 4096, NULL, 4, &playbackHandle) != pdPASS)
     showError("Insufficient memory to create playbackTask");
   sensor_t * s = esp_camera_sensor_get();
@@ -978,6 +2675,10 @@ static void deleteTask(TaskHandle_t thisTaskHandle) {
 void endTasks() {
   deleteTask(captureHandle);
   deleteTask(playbackHandle);
+  free(playBuffer);
+  playBuffer = NULL;
+  deleteTask(writerHandle);
+  deleteTask(thumbHandle);
   deleteTask(getDS18tempHandle);
 }
 
@@ -1013,5 +2714,6 @@ String upTime(){
   if(days > 0) ret += String(days) + "d ";
   if(hours > 0) ret += String(hours) + "h ";
   if(mins >= 0) ret += String(mins) + "m ";
-  if(secs >= 0) ret += String(secs) + "s ";  return ret;
+  if(secs >= 0) ret += String(secs) + "s ";
+  return ret;
 }
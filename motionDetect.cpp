@@ -45,6 +45,7 @@ extern uint8_t fsizePtr;
 extern uint8_t lightLevel; // Current ambient light level 
 extern SemaphoreHandle_t motionMutex;
 extern SemaphoreHandle_t frameMutex;
+extern SemaphoreHandle_t decodeMutex;
 extern float motionVal; // motion sensitivity setting - min percentage of changed pixels that constitute a movement
 extern uint16_t insufficient;
 
@@ -60,6 +61,7 @@ extern const frameStruct frameData[];
 
 static uint8_t* jpgImg = NULL;
 static size_t jpgImgSize = 0;
+uint32_t motionLevel = 0; // changed pixels in region of interest at last check
 
 /**********************************************************************************/
 
@@ -83,8 +85,14 @@ bool checkMotion(camera_fb_t * fb, bool motionStatus) {
   int sampleHeight = frameData[fsizePtr].frameHeight / downsize;
   int num_pixels = sampleWidth * sampleHeight;
 
-  if (!jpg2rgb((uint8_t*)fb->buf, fb->len, &rgb_buf, scaling))
-    showError("motionDetect: fmt2rgb() failed");
+  // jpeg decoder is not reentrant, so skip this check rather than wait for a thumbnail being made
+  if (!xSemaphoreTake(decodeMutex, 0)) {
+    motionLevel = 0; // not checked
+    return motionStatus;
+  }
+  bool decoded = jpg2rgb((uint8_t*)fb->buf, fb->len, &rgb_buf, scaling);
+  xSemaphoreGive(decodeMutex);
+  if (!decoded) showError("motionDetect: fmt2rgb() failed");
 
 /*
   if (reducer > 1) 
@@ -122,6 +130,7 @@ bool checkMotion(camera_fb_t * fb, bool motionStatus) {
   if (rgb_buf == NULL) showError("Memory leak, heap now: %u, pSRAM now: %u", ESP.getFreeHeap(), ESP.getFreePsram());
   free(rgb_buf); 
   rgb_buf = NULL;
+  motionLevel = changeCount;
   showDebug("Detected %u changes, threshold %u, light level %u, in %lums", changeCount, moveThreshold, lightLevel, millis() - dTime);
   dTime = millis();
 
@@ -159,7 +168,7 @@ bool checkMotion(camera_fb_t * fb, bool motionStatus) {
     xSemaphoreGive(motionMutex);
     free(jpg_buf);
     jpg_buf = NULL;
-    showDebug("Created changeMap JPEG %d bytes in %lums", jpg_len, millis() - dTime);
+    showDebug("Created changeMap JPEG %zu bytes in %lums", jpg_len, millis() - dTime);
   }
 
   showDebug("Free heap: %u, free pSRAM %u", ESP.getFreeHeap(), ESP.getFreePsram());
@@ -210,10 +219,11 @@ typedef struct {
   uint16_t data_offset;
   const uint8_t *input;
   uint8_t *output;
+  bool colour; // mjpeg2sd: RGB888 output for thumbnails, else 8 bit grayscale
 } rgb_jpg_decoder;
 
 static bool _rgb_write(void * arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
-  // mpjpeg2sd: mofified to generate 8 bit grayscale
+  // mpjpeg2sd: mofified to generate 8 bit grayscale, or RGB888 if colour
   rgb_jpg_decoder * jpeg = (rgb_jpg_decoder *)arg;
   if (!data){
     if (x == 0 && y == 0) {
@@ -222,7 +232,7 @@ static bool _rgb_write(void * arg, uint16_t x, uint16_t y, uint16_t w, uint16_t
       jpeg->height = h;
       // if output is null, this is BMP
       if (!jpeg->output) {
-        jpeg->output = (uint8_t*)ps_malloc((w*h)+jpeg->data_offset);
+        jpeg->output = (uint8_t*)ps_malloc((w*h*(jpeg->colour ? RGB888_BYTES : 1))+jpeg->data_offset);
         if (!jpeg->output) return false;
       }
     } 
@@ -238,6 +248,19 @@ static bool _rgb_write(void * arg, uint16_t x, uint16_t y, uint16_t w, uint16_t
   size_t iy, ix;
   w *= RGB888_BYTES;
 
+  if (jpeg->colour) {
+    // as esp32-camera to_bmp.c, stored BGR as for PIXFORMAT_RGB888
+    for (iy=t; iy<b; iy+=jw) {
+      o = out+iy+l;
+      for (ix=0; ix<w; ix+=RGB888_BYTES) {
+        o[ix] = data[ix+2];
+        o[ix+1] = data[ix+1];
+        o[ix+2] = data[ix];
+      }
+      data+=w;
+    }
+    return true;
+  }
   for (iy=t; iy<b; iy+=jw) {
     o = out+(iy+l)/RGB888_BYTES;
     for (ix=0; ix<w; ix+=RGB888_BYTES) {
@@ -262,7 +285,25 @@ static bool jpg2rgb(const uint8_t *src, size_t src_len, uint8_t **out, uint8_t s
   jpeg.input = src;
   jpeg.output = NULL; 
   jpeg.data_offset = 0;
+  jpeg.colour = false;
   esp_err_t res = esp_jpg_decode(src_len, jpg_scale_t(scale), _jpg_read, _rgb_write, (void*)&jpeg);
   *out = jpeg.output;
   return (res == ESP_OK) ? true : false;
 }
+
+bool jpg2thumb(const uint8_t *src, size_t src_len, uint8_t scale, uint8_t quality, uint8_t **out, size_t *out_len) {
+  // mjpeg2sd: downscale jpeg to colour thumbnail jpeg, output to be freed by caller
+  rgb_jpg_decoder jpeg;
+  jpeg.width = 0;
+  jpeg.height = 0;
+  jpeg.input = src;
+  jpeg.output = NULL; 
+  jpeg.data_offset = 0;
+  jpeg.colour = true;
+  *out = NULL;
+  esp_err_t res = esp_jpg_decode(src_len, jpg_scale_t(scale), _jpg_read, _rgb_write, (void*)&jpeg);
+  if (res == ESP_OK) res = fmt2jpg(jpeg.output, jpeg.width * jpeg.height * RGB888_BYTES, jpeg.width, jpeg.height, 
+    PIXFORMAT_RGB888, quality, out, out_len) ? ESP_OK : ESP_FAIL;
+  free(jpeg.output);
+  return (res == ESP_OK) ? true : false;
+}
@@ -44,6 +44,7 @@ char ftp_wd[64]     = "/home/user/";
 char timezone[64] = "GMT0BST,M3.5.0/01,M10.5.0/02";
 uint8_t fsizePtr; // index to frameData[]
 uint8_t minSeconds = 5; // default min video length (includes POST_MOTION_TIME)
+uint16_t segmentSecs = 300; // length of each segment file of a long recording, 0 to only split at MAX_FRAMES
 bool doRecording = true; // whether to capture to SD or not
 extern uint8_t FPS;
 extern bool aviOn;                 
@@ -51,6 +52,10 @@ bool lampVal = false;
 void controlLamp(bool lampVal);
 uint8_t nightSwitch = 20; // initial white level % for night/day switching
 float motionVal = 8.0; // initial motion sensitivity setting
+bool autoQuality = false; // adjust jpeg quality during recording to sustain FPS
+uint8_t qualityMin = 10; // best jpeg quality used by autoQuality (lower value is better quality)
+uint8_t qualityMax = 30; // worst jpeg quality used by autoQuality
+bool aviRecord = false; // record as AVI, so recordings are uploaded and downloaded without conversion
 
 /*  Handle config nvs load & save and wifi start   */
 DNSServer dnsAPServer;                      
@@ -93,11 +98,16 @@ bool saveConfig() {
   pref.putUShort("framesize", fsizePtr);
   pref.putUChar("fps", FPS);
   pref.putUChar("minf", minSeconds);
+  pref.putUShort("segSecs", segmentSecs);
   pref.putBool("doRecording", doRecording);
   pref.putFloat("motion", motionVal);
   pref.putBool("lamp", lampVal);
   pref.putBool("aviOn", aviOn);                              
   pref.putUChar("lswitch", nightSwitch);
+  pref.putBool("autoQ", autoQuality);
+  pref.putUChar("qmin", qualityMin);
+  pref.putUChar("qmax", qualityMax);
+  pref.putBool("aviRecord", aviRecord);
 
   pref.putString("ftp_server", ftp_server);
   pref.putString("ftp_port", ftp_port);
@@ -148,12 +158,17 @@ bool loadConfig() {
   fsizePtr = pref.getUShort("framesize", fsizePtr);
   FPS = pref.getUChar("fps", FPS);
   minSeconds = pref.getUChar("minf", minSeconds );
+  segmentSecs = pref.getUShort("segSecs", segmentSecs);
   doRecording = pref.getBool("doRecording", doRecording);
   aviOn = pref.getBool("aviOn", aviOn);                                       
   motionVal = pref.getFloat("motion", motionVal);
   lampVal = pref.getBool("lamp", lampVal);
   controlLamp(lampVal);
   nightSwitch = pref.getUChar("lswitch", nightSwitch);
+  autoQuality = pref.getBool("autoQ", autoQuality);
+  qualityMin = pref.getUChar("qmin", qualityMin);
+  qualityMax = pref.getUChar("qmax", qualityMax);
+  aviRecord = pref.getBool("aviRecord", aviRecord);
 
   strcpy(timezone, pref.getString("timezone", String(timezone)).c_str());
   strcpy(ftp_server, pref.getString("ftp_server", String(ftp_server)).c_str());